@@ -0,0 +1,93 @@
+# Helpers for the DUMMY_MODE benchmarks in this directory.
+#
+# The benchmarks need a netifd binary built with DUMMY_MODE (set NETIFD to
+# its path, the default is ./netifd in the source tree) and a running ubusd.
+# Each one runs netifd in a temporary directory with a generated network
+# config and reads the results from "ubus call network stats".
+
+. /usr/share/libubox/jshn.sh
+
+BENCH_SRC="$(cd "$(dirname "$0")/.." && pwd)"
+NETIFD="$(readlink -f "${NETIFD:-$BENCH_SRC/netifd}")"
+
+bench_done() {
+	[ -n "$BENCH_PID" ] && {
+		kill "$BENCH_PID"
+		wait "$BENCH_PID"
+	} 2>/dev/null
+	rm -rf "$BENCH_DIR"
+}
+
+bench_init() {
+	[ -x "$NETIFD" ] || {
+		echo "netifd binary not found, set NETIFD" >&2
+		exit 1
+	}
+
+	BENCH_DIR="$(mktemp -d)"
+	BENCH_PID=
+	mkdir "$BENCH_DIR/config" "$BENCH_DIR/tmp"
+	mkdir -p "$BENCH_DIR/dummy/proto"
+	ln -s "$BENCH_SRC/dummy/netifd-proto.sh" "$BENCH_DIR/dummy/"
+	ln -s "$BENCH_SRC/dummy/proto/"*.sh "$BENCH_SRC/bench/proto/"*.sh \
+		"$BENCH_DIR/dummy/proto/"
+	ln -s "$BENCH_SRC/scripts" "$BENCH_DIR/scripts"
+	BENCH_CONFIG="$BENCH_DIR/config/network"
+	: > "$BENCH_CONFIG"
+	trap bench_done EXIT
+}
+
+# <interface> <ifname> [proto]
+bench_add_interface() {
+	printf 'config interface %s\n\toption ifname\t%s\n\toption proto\t%s\n\n' \
+		"$1" "$2" "${3:-none}" >> "$BENCH_CONFIG"
+}
+
+# <name>, a device section with the default settings
+bench_add_device() {
+	printf 'config device\n\toption name\t%s\n\n' "$1" >> "$BENCH_CONFIG"
+}
+
+bench_start() {
+	(cd "$BENCH_DIR" && exec "$NETIFD" -l 0 "$@") &
+	BENCH_PID=$!
+
+	# netifd answers calls only after the initial config load
+	while ! ubus list network >/dev/null 2>&1; do
+		sleep 1
+	done
+	bench_stats
+}
+
+# load the current stats, bench_get <table> <key> reads values from them
+bench_stats() {
+	json_load "$(ubus -t 300 call network stats)"
+}
+
+bench_get() {
+	local table="$1"
+	local key="$2"
+	local val
+
+	json_select "$table"
+	json_get_var val "$key"
+	json_select ..
+	echo "$val"
+}
+
+# <pool> <key>, from the "memory" table
+bench_get_pool() {
+	local pool="$1"
+	local key="$2"
+	local val
+
+	json_select memory
+	json_select "$pool" && json_get_var val "$key" && json_select ..
+	json_select ..
+	echo "${val:-0}"
+}
+
+# resident set size of netifd in kB
+bench_rss() {
+	sed -n 's/^VmRSS:[[:space:]]*\([0-9]*\) kB/\1/p' "/proc/$BENCH_PID/status"
+}
@@ -0,0 +1,40 @@
+#!/bin/sh
+# Report the memory used per device. netifd starts with an empty config,
+# then a reload adds <count> simple devices and <count> VLANs on the first
+# of them. The RSS growth includes the parsed config; the pool bytes are
+# the device objects alone.
+
+. "$(dirname "$0")/common.sh"
+
+COUNT="${1:-4094}"
+
+[ "$COUNT" -ge 1 ] && [ "$COUNT" -le 4094 ] || {
+	echo "count must be a valid VLAN id" >&2
+	exit 1
+}
+
+bench_init
+bench_start
+rss="$(bench_rss)"
+
+n=1
+while [ "$n" -le "$COUNT" ]; do
+	bench_add_device "bench$n"
+	bench_add_device "bench1.$n"
+	n=$((n + 1))
+done
+
+ubus -t 300 call network reload
+bench_stats
+rss=$(($(bench_rss) - rss))
+
+devices=$((2 * COUNT))
+echo "$COUNT devices and $COUNT VLANs: RSS +${rss}kB," \
+	"$((rss * 1024 / devices)) bytes per device"
+
+for pool in device vlan; do
+	size="$(bench_get_pool "$pool" object_size)"
+	in_use="$(bench_get_pool "$pool" in_use)"
+	bytes="$(bench_get_pool "$pool" bytes)"
+	echo "$pool: ${size} bytes per object, $in_use in use, $bytes bytes in the pool"
+done
@@ -0,0 +1,21 @@
+#!/bin/sh
+# Protocol for the benchmarks, its updates are sent by the benchmark
+# scripts instead of a setup handler.
+
+. ../netifd-proto.sh
+init_proto "$@"
+
+proto_bench_init_config() {
+	no_device=1
+	available=1
+}
+
+proto_bench_setup() {
+	return
+}
+
+proto_bench_teardown() {
+	return
+}
+
+add_protocol bench
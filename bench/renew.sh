@@ -0,0 +1,70 @@
+#!/bin/sh
+# Replay DHCP renewals carrying a large route set and report the work done
+# for them: protocol updates and skipped updates, route pool usage and the
+# number of route objects and pool chunks allocated.
+#
+# usage: renew.sh [routes] [renewals]
+#
+# The first half of the renewals repeats the previous update unchanged.
+# In the second half one route alternates between two gateways, so every
+# update rebuilds the route list of the interface. All counts are totals
+# since netifd was started.
+
+. "$(dirname "$0")/common.sh"
+. "$BENCH_SRC/dummy/netifd-proto.sh"
+
+ROUTES="${1:-1000}"
+RENEWALS="${2:-100}"
+
+bench_renew() {
+	local gw="$1"
+
+	proto_init_update "bench0" 1
+	proto_add_ipv4_address 10.0.0.2 24
+	PROTO_ROUTE="$BENCH_ROUTES"
+	proto_add_ipv4_route 192.168.0.0 16 "$gw"
+	proto_send_update wan
+}
+
+bench_report() {
+	local label="$1"
+	local start="$2"
+
+	bench_stats
+	echo "$label: $(($(date +%s) - start))s," \
+		"updates $(bench_get proto updates)," \
+		"skipped $(bench_get proto updates_skipped)," \
+		"route4 in use $(bench_get_pool route4 in_use)," \
+		"allocs $(bench_get_pool route4 allocs)," \
+		"chunks $(bench_get_pool route4 chunks)," \
+		"bytes $(bench_get_pool route4 bytes)"
+}
+
+bench_init
+printf 'config interface wan\n\toption proto\tbench\n\n' > "$BENCH_CONFIG"
+
+i=0
+BENCH_ROUTES=
+while [ "$i" -lt "$ROUTES" ]; do
+	BENCH_ROUTES="$BENCH_ROUTES 10.$((i / 256 % 256)).$((i % 256)).0/24/10.0.0.1"
+	i=$((i + 1))
+done
+
+bench_start
+bench_renew 10.0.0.1
+bench_report "initial update" "$(date +%s)"
+
+start="$(date +%s)"
+i=0
+while [ "$i" -lt "$((RENEWALS / 2))" ]; do
+	bench_renew 10.0.0.1
+	i=$((i + 1))
+done
+bench_report "unchanged renewals" "$start"
+
+start="$(date +%s)"
+while [ "$i" -lt "$RENEWALS" ]; do
+	bench_renew "10.0.0.$((i % 2 + 1))"
+	i=$((i + 1))
+done
+bench_report "changed renewals" "$start"
@@ -0,0 +1,24 @@
+#!/bin/sh
+# Create all 4094 VLANs on one parent device and report the time taken by
+# the initial config load and by a reload that finds every VLAN again.
+
+. "$(dirname "$0")/common.sh"
+
+PARENT="${1:-eth0}"
+
+bench_init
+
+vid=1
+while [ "$vid" -le 4094 ]; do
+	bench_add_interface "vlan$vid" "$PARENT.$vid"
+	vid=$((vid + 1))
+done
+
+bench_start
+load="$(bench_get config last_time)"
+
+ubus -t 300 call network reload
+bench_stats
+reload="$(bench_get config last_time)"
+
+echo "4094 VLANs on $PARENT: load ${load}ms, reload ${reload}ms"
@@ -30,6 +30,7 @@ enum {
 	BRIDGE_ATTR_AGEING_TIME,
 	BRIDGE_ATTR_HELLO_TIME,
 	BRIDGE_ATTR_MAX_AGE,
+	BRIDGE_ATTR_VLAN_FILTERING,
 	__BRIDGE_ATTR_MAX
 };
 
@@ -41,6 +42,7 @@ static const struct blobmsg_policy bridge_attrs[__BRIDGE_ATTR_MAX] = {
 	[BRIDGE_ATTR_HELLO_TIME] = { "hello_time", BLOBMSG_TYPE_INT32 },
 	[BRIDGE_ATTR_MAX_AGE] = { "max_age", BLOBMSG_TYPE_INT32 },
 	[BRIDGE_ATTR_IGMP_SNOOP] = { "igmp_snooping", BLOBMSG_TYPE_BOOL },
+	[BRIDGE_ATTR_VLAN_FILTERING] = { "vlan_filtering", BLOBMSG_TYPE_BOOL },
 };
 
 static const union config_param_info bridge_attr_info[__BRIDGE_ATTR_MAX] = {
@@ -56,13 +58,40 @@ static const struct config_param_list bridge_attr_list = {
 	.next = { &device_attr_list },
 };
 
+enum {
+	BRVLAN_ATTR_VLAN,
+	BRVLAN_ATTR_PORTS,
+	BRVLAN_ATTR_LOCAL,
+	__BRVLAN_ATTR_MAX
+};
+
+static const struct blobmsg_policy bridge_vlan_attrs[__BRVLAN_ATTR_MAX] = {
+	[BRVLAN_ATTR_VLAN] = { "vlan", BLOBMSG_TYPE_STRING },
+	[BRVLAN_ATTR_PORTS] = { "ports", BLOBMSG_TYPE_ARRAY },
+	[BRVLAN_ATTR_LOCAL] = { "local", BLOBMSG_TYPE_BOOL },
+};
+
+static const union config_param_info bridge_vlan_attr_info[__BRVLAN_ATTR_MAX] = {
+	[BRVLAN_ATTR_PORTS] = { .type = BLOBMSG_TYPE_STRING },
+};
+
+const struct config_param_list bridge_vlan_attr_list = {
+	.n_params = __BRVLAN_ATTR_MAX,
+	.params = bridge_vlan_attrs,
+	.info = bridge_vlan_attr_info,
+};
+
 static struct device *bridge_create(const char *name, struct blob_attr *attr);
 static void bridge_config_init(struct device *dev);
 static void bridge_free(struct device *dev);
 static void bridge_dump_info(struct device *dev, struct blob_buf *b);
+static int bridge_vlan_add(struct device *dev, struct blob_attr *attr);
+static void bridge_vlan_update(struct device *dev, bool flush);
 enum dev_change_type
 bridge_reload(struct device *dev, struct blob_attr *attr);
 
+static const struct device_hotplug_ops bridge_ops;
+
 const struct device_type bridge_device_type = {
 	.name = "Bridge",
 	.config_params = &bridge_attr_list,
@@ -72,6 +101,10 @@ const struct device_type bridge_device_type = {
 	.reload = bridge_reload,
 	.free = bridge_free,
 	.dump_info = bridge_dump_info,
+	.vlan_add = bridge_vlan_add,
+	.vlan_update = bridge_vlan_update,
+
+	.hotplug_ops = &bridge_ops,
 };
 
 struct bridge_state {
@@ -86,7 +119,10 @@ struct bridge_state {
 
 	struct bridge_member *primary_port;
 	struct vlist_tree members;
+	struct list_head member_ranges;
 	int n_present;
+
+	struct vlist_tree vlans;
 };
 
 struct bridge_member {
@@ -94,9 +130,138 @@ struct bridge_member {
 	struct bridge_state *bst;
 	struct device_user dev;
 	bool present;
-	char name[];
+	bool range;
+	char name[IFNAMSIZ + 1];
 };
 
+static struct obj_pool bridge_member_pool =
+	OBJ_POOL("bridge_member", struct bridge_member);
+
+/*
+ * VLAN range in the member list, e.g. eth0.100-999. Members of a range
+ * are only created once a VID from it is added to the bridge.
+ */
+struct bridge_member_range {
+	struct list_head list;
+	int start, end;
+	char base[];
+};
+
+struct bridge_vlan_port {
+	const char *ifname;
+	unsigned int flags;
+};
+
+/* kernel VLAN filtering entry, covering the VIDs vid..vid_end */
+struct bridge_vlan {
+	struct vlist_node node;
+
+	uint16_t vid;
+	uint16_t vid_end;
+	bool local;
+
+	int n_ports;
+	struct bridge_vlan_port ports[];
+};
+
+static int
+bridge_vlan_port_flags(struct bridge_vlan *vlan, const char *ifname)
+{
+	int i;
+
+	for (i = 0; i < vlan->n_ports; i++) {
+		if (!strcmp(vlan->ports[i].ifname, ifname))
+			return vlan->ports[i].flags;
+	}
+
+	return -1;
+}
+
+/*
+ * Append the VLAN to a list of ranges, merging it with the previous entry
+ * where possible. The kernel does not accept a PVID on a range.
+ */
+static int
+bridge_vlan_range_add(struct bridge_vlan_range *r, int n, struct bridge_vlan *vlan,
+		      unsigned int flags)
+{
+	uint16_t vid = vlan->vid;
+
+	if (flags & BRVLAN_F_PVID) {
+		r[n].vid = r[n].vid_end = vid++;
+		r[n++].flags = flags;
+		flags &= ~BRVLAN_F_PVID;
+		if (vid > vlan->vid_end)
+			return n;
+	}
+
+	if (n > 0 && r[n - 1].flags == flags && r[n - 1].vid_end + 1 == vid) {
+		r[n - 1].vid_end = vlan->vid_end;
+		return n;
+	}
+
+	r[n].vid = vid;
+	r[n].vid_end = vlan->vid_end;
+	r[n++].flags = flags;
+	return n;
+}
+
+static void
+bridge_vlan_apply_port(struct bridge_state *bst, struct device *dev, bool add)
+{
+	struct bridge_vlan_range *r;
+	struct bridge_vlan *vlan;
+	bool self = (dev == &bst->dev);
+	int flags, n = 0;
+
+	if (!bst->config.vlan_filtering)
+		return;
+
+	r = alloca(2 * bst->vlans.avl.count * sizeof(*r) + 1);
+	vlist_for_each_element(&bst->vlans, vlan, node) {
+		flags = bridge_vlan_port_flags(vlan, dev->ifname);
+		if (flags < 0) {
+			if (!self || !vlan->local)
+				continue;
+
+			flags = 0;
+		}
+
+		n = bridge_vlan_range_add(r, n, vlan, flags);
+	}
+
+	system_bridge_vlan(dev, r, n, add, self);
+}
+
+static void
+bridge_vlan_apply(struct bridge_state *bst, struct bridge_vlan *vlan, bool add)
+{
+	struct bridge_vlan_range r[2];
+	struct bridge_member *bm;
+	int i, n;
+
+	if (!bst->config.vlan_filtering || !bst->dev.active)
+		return;
+
+	for (i = 0; i < vlan->n_ports; i++) {
+		bm = vlist_find(&bst->members, vlan->ports[i].ifname, bm, node);
+		if (!bm || !bm->present)
+			continue;
+
+		n = bridge_vlan_range_add(r, 0, vlan, vlan->ports[i].flags);
+		system_bridge_vlan(bm->dev.dev, r, n, add, false);
+	}
+
+	i = bridge_vlan_port_flags(vlan, bst->dev.ifname);
+	if (i < 0 && vlan->local)
+		i = 0;
+
+	if (i >= 0) {
+		n = bridge_vlan_range_add(r, 0, vlan, i);
+		system_bridge_vlan(&bst->dev, r, n, add, true);
+	}
+}
+
 static void
 bridge_reset_primary(struct bridge_state *bst)
 {
@@ -134,7 +299,7 @@ bridge_disable_member(struct bridge_member *bm)
 }
 
 static int
-bridge_enable_member(struct bridge_member *bm)
+bridge_claim_member(struct bridge_member *bm)
 {
 	struct bridge_state *bst = bm->bst;
 	int ret;
@@ -143,21 +308,46 @@ bridge_enable_member(struct bridge_member *bm)
 		return 0;
 
 	ret = device_claim(&bm->dev);
-	if (ret < 0)
-		goto error;
+	if (ret < 0) {
+		bm->present = false;
+		bst->n_present--;
+	}
+
+	return ret;
+}
+
+static int
+bridge_attach_member(struct bridge_member *bm)
+{
+	struct bridge_state *bst = bm->bst;
+	int ret;
+
+	if (!bm->present)
+		return 0;
 
 	ret = system_bridge_addif(&bst->dev, bm->dev.dev);
 	if (ret < 0) {
 		D(DEVICE, "Bridge device %s could not be added\n", bm->dev.dev->ifname);
-		goto error;
+		bm->present = false;
+		bst->n_present--;
+		return ret;
 	}
 
+	bridge_vlan_apply_port(bst, bm->dev.dev, true);
+
 	return 0;
+}
 
-error:
-	bm->present = false;
-	bst->n_present--;
-	return ret;
+static int
+bridge_enable_member(struct bridge_member *bm)
+{
+	int ret;
+
+	ret = bridge_claim_member(bm);
+	if (ret < 0)
+		return ret;
+
+	return bridge_attach_member(bm);
 }
 
 static void
@@ -244,8 +434,18 @@ bridge_set_up(struct bridge_state *bst)
 	if (ret < 0)
 		goto out;
 
+	bridge_vlan_apply_port(bst, &bst->dev, true);
+
+	/*
+	 * Bring up all members before adding the first port: the link
+	 * requests of the whole layer go out back to back, and adding the
+	 * first port collects all of their replies in one pass.
+	 */
+	vlist_for_each_element(&bst->members, bm, node)
+		bridge_claim_member(bm);
+
 	vlist_for_each_element(&bst->members, bm, node)
-		bridge_enable_member(bm);
+		bridge_attach_member(bm);
 
 	if (!bst->force_active && !bst->n_present) {
 		/* initialization of all member interfaces failed */
@@ -281,7 +481,10 @@ bridge_create_member(struct bridge_state *bst, struct device *dev, bool hotplug)
 {
 	struct bridge_member *bm;
 
-	bm = calloc(1, sizeof(*bm) + strlen(dev->ifname) + 1);
+	bm = obj_pool_alloc(&bridge_member_pool);
+	if (!bm)
+		return NULL;
+
 	bm->bst = bst;
 	bm->dev.cb = bridge_member_cb;
 	bm->dev.hotplug = hotplug;
@@ -305,7 +508,7 @@ bridge_member_update(struct vlist_tree *tree, struct vlist_node *node_new,
 		bm = container_of(node_new, struct bridge_member, node);
 
 		if (node_old) {
-			free(bm);
+			obj_pool_free(&bridge_member_pool, bm);
 			return;
 		}
 
@@ -319,7 +522,7 @@ bridge_member_update(struct vlist_tree *tree, struct vlist_node *node_new,
 		bm = container_of(node_old, struct bridge_member, node);
 		bridge_remove_member(bm);
 		device_remove_user(&bm->dev);
-		free(bm);
+		obj_pool_free(&bridge_member_pool, bm);
 	}
 }
 
@@ -336,10 +539,49 @@ bridge_add_member(struct bridge_state *bst, const char *name)
 	bridge_create_member(bst, dev, false);
 }
 
+static bool
+bridge_member_in_range(struct bridge_state *bst, const char *name)
+{
+	struct bridge_member_range *r;
+	const char *sep;
+	char *err;
+	int len, id;
+
+	sep = strrchr(name, '.');
+	if (!sep)
+		return false;
+
+	id = strtoul(sep + 1, &err, 10);
+	if (*err)
+		return false;
+
+	len = sep - name;
+	list_for_each_entry(r, &bst->member_ranges, list) {
+		if (id < r->start || id > r->end)
+			continue;
+
+		if (strlen(r->base) == len && !strncmp(r->base, name, len))
+			return true;
+	}
+
+	return false;
+}
+
 static int
 bridge_hotplug_add(struct device *dev, struct device *member)
 {
 	struct bridge_state *bst = container_of(dev, struct bridge_state, dev);
+	struct bridge_member *bm;
+
+	/* a VID from a configured range becomes a regular member */
+	if (bridge_member_in_range(bst, member->ifname)) {
+		/* look it up again, an existing member is kept on update */
+		bridge_create_member(bst, member, false);
+		bm = vlist_find(&bst->members, member->ifname, bm, node);
+		if (bm)
+			bm->range = true;
+		return 0;
+	}
 
 	bridge_create_member(bst, member, true);
 
@@ -378,13 +620,26 @@ static const struct device_hotplug_ops bridge_ops = {
 	.del = bridge_hotplug_del
 };
 
+static void
+bridge_free_member_ranges(struct bridge_state *bst)
+{
+	struct bridge_member_range *r, *tmp;
+
+	list_for_each_entry_safe(r, tmp, &bst->member_ranges, list) {
+		list_del(&r->list);
+		free(r);
+	}
+}
+
 static void
 bridge_free(struct device *dev)
 {
 	struct bridge_state *bst;
 
 	bst = container_of(dev, struct bridge_state, dev);
+	vlist_flush_all(&bst->vlans);
 	vlist_flush_all(&bst->members);
+	bridge_free_member_ranges(bst);
 	free(bst);
 }
 
@@ -393,6 +648,7 @@ bridge_dump_info(struct device *dev, struct blob_buf *b)
 {
 	struct bridge_state *bst;
 	struct bridge_member *bm;
+	struct bridge_vlan *vlan;
 	void *list;
 
 	bst = container_of(dev, struct bridge_state, dev);
@@ -404,12 +660,231 @@ bridge_dump_info(struct device *dev, struct blob_buf *b)
 		blobmsg_add_string(b, NULL, bm->dev.dev->ifname);
 
 	blobmsg_close_array(b, list);
+
+	if (!list_empty(&bst->member_ranges)) {
+		struct bridge_member_range *r;
+		char buf[IFNAMSIZ + 12];
+
+		list = blobmsg_open_array(b, "bridge-member-ranges");
+		list_for_each_entry(r, &bst->member_ranges, list) {
+			snprintf(buf, sizeof(buf), "%s.%d-%d", r->base, r->start, r->end);
+			blobmsg_add_string(b, NULL, buf);
+		}
+		blobmsg_close_array(b, list);
+	}
+
+	if (!bst->config.vlan_filtering)
+		return;
+
+	list = blobmsg_open_array(b, "bridge-vlans");
+	vlist_for_each_element(&bst->vlans, vlan, node) {
+		void *v, *p;
+		char buf[IFNAMSIZ + 4];
+		int i;
+
+		v = blobmsg_open_table(b, NULL);
+		blobmsg_add_u32(b, "id", vlan->vid);
+		if (vlan->vid_end != vlan->vid)
+			blobmsg_add_u32(b, "id_end", vlan->vid_end);
+		blobmsg_add_u8(b, "local", vlan->local);
+
+		p = blobmsg_open_array(b, "ports");
+		for (i = 0; i < vlan->n_ports; i++) {
+			snprintf(buf, sizeof(buf), "%s%s%s", vlan->ports[i].ifname,
+				 (vlan->ports[i].flags & BRVLAN_F_UNTAGGED) ? ":u" : ":t",
+				 (vlan->ports[i].flags & BRVLAN_F_PVID) ? "*" : "");
+			blobmsg_add_string(b, NULL, buf);
+		}
+		blobmsg_close_array(b, p);
+		blobmsg_close_table(b, v);
+	}
+	blobmsg_close_array(b, list);
+}
+
+static bool
+bridge_vlan_equal(struct bridge_vlan *v1, struct bridge_vlan *v2)
+{
+	int i;
+
+	if (v1->vid_end != v2->vid_end || v1->local != v2->local ||
+	    v1->n_ports != v2->n_ports)
+		return false;
+
+	for (i = 0; i < v1->n_ports; i++) {
+		if (v1->ports[i].flags != v2->ports[i].flags ||
+		    strcmp(v1->ports[i].ifname, v2->ports[i].ifname) != 0)
+			return false;
+	}
+
+	return true;
+}
+
+static void
+bridge_vlan_tree_update(struct vlist_tree *tree, struct vlist_node *node_new,
+			struct vlist_node *node_old)
+{
+	struct bridge_state *bst = container_of(tree, struct bridge_state, vlans);
+	struct bridge_vlan *vlan_new = NULL, *vlan_old = NULL;
+
+	if (node_new)
+		vlan_new = container_of(node_new, struct bridge_vlan, node);
+	if (node_old)
+		vlan_old = container_of(node_old, struct bridge_vlan, node);
+
+	if (vlan_old && vlan_new && bridge_vlan_equal(vlan_old, vlan_new)) {
+		free(vlan_old);
+		return;
+	}
+
+	if (vlan_old) {
+		bridge_vlan_apply(bst, vlan_old, false);
+		free(vlan_old);
+	}
+
+	if (vlan_new)
+		bridge_vlan_apply(bst, vlan_new, true);
+}
+
+static int
+bridge_vlan_parse_id(const char *str, uint16_t *vid, uint16_t *vid_end)
+{
+	unsigned long start, end;
+	char *err;
+
+	start = end = strtoul(str, &err, 10);
+	if (*err == '-')
+		end = strtoul(err + 1, &err, 10);
+
+	if (*err || !start || start > end || end > 4094)
+		return -EINVAL;
+
+	*vid = start;
+	*vid_end = end;
+	return 0;
+}
+
+static int
+bridge_vlan_add(struct device *dev, struct blob_attr *attr)
+{
+	struct bridge_state *bst = container_of(dev, struct bridge_state, dev);
+	struct blob_attr *tb[__BRVLAN_ATTR_MAX];
+	struct bridge_vlan_port *port;
+	struct bridge_vlan *vlan;
+	struct blob_attr *cur;
+	int n_ports = 0, name_len = 0;
+	uint16_t vid, vid_end;
+	char *name_buf, *sep;
+	int rem;
+
+	blobmsg_parse(bridge_vlan_attrs, __BRVLAN_ATTR_MAX, tb,
+		blob_data(attr), blob_len(attr));
+
+	if (!tb[BRVLAN_ATTR_VLAN] ||
+	    bridge_vlan_parse_id(blobmsg_data(tb[BRVLAN_ATTR_VLAN]), &vid, &vid_end))
+		return -EINVAL;
+
+	if ((cur = tb[BRVLAN_ATTR_PORTS])) {
+		blobmsg_for_each_attr(cur, tb[BRVLAN_ATTR_PORTS], rem) {
+			n_ports++;
+			name_len += strlen(blobmsg_data(cur)) + 1;
+		}
+	}
+
+	vlan = calloc(1, sizeof(*vlan) + n_ports * sizeof(*port) + name_len);
+	if (!vlan)
+		return -ENOMEM;
+
+	vlan->vid = vid;
+	vlan->vid_end = vid_end;
+	vlan->local = blobmsg_get_bool_default(tb[BRVLAN_ATTR_LOCAL], true);
+
+	/* ports are written as <ifname>[:t|u][*], tagged unless specified */
+	name_buf = (char *) &vlan->ports[n_ports];
+	if (n_ports) {
+		blobmsg_for_each_attr(cur, tb[BRVLAN_ATTR_PORTS], rem) {
+			port = &vlan->ports[vlan->n_ports++];
+			strcpy(name_buf, blobmsg_data(cur));
+			port->ifname = name_buf;
+			name_buf += strlen(name_buf) + 1;
+
+			sep = strchr(port->ifname, ':');
+			if (!sep)
+				continue;
+
+			*(sep++) = 0;
+			for (; *sep; sep++) {
+				if (*sep == 'u')
+					port->flags |= BRVLAN_F_UNTAGGED;
+				else if (*sep == 't')
+					port->flags &= ~BRVLAN_F_UNTAGGED;
+				else if (*sep == '*')
+					port->flags |= BRVLAN_F_PVID;
+			}
+		}
+	}
+
+	vlist_add(&bst->vlans, &vlan->node, &vlan->vid);
+	return 0;
+}
+
+static void
+bridge_vlan_update(struct device *dev, bool flush)
+{
+	struct bridge_state *bst = container_of(dev, struct bridge_state, dev);
+
+	if (flush)
+		vlist_flush(&bst->vlans);
+	else
+		vlist_update(&bst->vlans);
+}
+
+static int
+bridge_vlan_cmp(const void *k1, const void *k2, void *ptr)
+{
+	const uint16_t *v1 = k1, *v2 = k2;
+
+	return *v1 - *v2;
+}
+
+static bool
+bridge_add_member_range(struct bridge_state *bst, const char *name)
+{
+	struct bridge_member_range *r;
+	const char *sep;
+	unsigned long start, end;
+	char *err;
+
+	sep = strrchr(name, '.');
+	if (!sep || !strchr(sep, '-'))
+		return false;
+
+	start = strtoul(sep + 1, &err, 10);
+	if (*err != '-')
+		return false;
+
+	end = strtoul(err + 1, &err, 10);
+	if (*err || !start || start > end || end > 4094) {
+		D(DEVICE, "Invalid VLAN range '%s' in bridge '%s'\n", name, bst->dev.ifname);
+		return true;
+	}
+
+	r = calloc(1, sizeof(*r) + (sep - name) + 1);
+	if (!r)
+		return true;
+
+	r->start = start;
+	r->end = end;
+	memcpy(r->base, name, sep - name);
+	list_add_tail(&r->list, &bst->member_ranges);
+
+	return true;
 }
 
 static void
 bridge_config_init(struct device *dev)
 {
 	struct bridge_state *bst;
+	struct bridge_member *bm;
 	struct blob_attr *cur;
 	int rem;
 
@@ -418,10 +893,20 @@ bridge_config_init(struct device *dev)
 	if (!bst->ifnames)
 		return;
 
+	bridge_free_member_ranges(bst);
 	vlist_update(&bst->members);
 	blobmsg_for_each_attr(cur, bst->ifnames, rem) {
+		if (bridge_add_member_range(bst, blobmsg_data(cur)))
+			continue;
+
 		bridge_add_member(bst, blobmsg_data(cur));
 	}
+
+	/* keep members created from a range that is still configured */
+	vlist_for_each_element(&bst->members, bm, node) {
+		if (bm->range && bridge_member_in_range(bst, bm->name))
+			bm->node.version = bst->members.version;
+	}
 	vlist_flush(&bst->members);
 }
 
@@ -435,6 +920,7 @@ bridge_apply_settings(struct bridge_state *bst, struct blob_attr **tb)
 	cfg->stp = false;
 	cfg->forward_delay = 2;
 	cfg->igmp_snoop = true;
+	cfg->vlan_filtering = false;
 
 	if ((cur = tb[BRIDGE_ATTR_STP]))
 		cfg->stp = blobmsg_get_bool(cur);
@@ -445,6 +931,9 @@ bridge_apply_settings(struct bridge_state *bst, struct blob_attr **tb)
 	if ((cur = tb[BRIDGE_ATTR_IGMP_SNOOP]))
 		cfg->igmp_snoop = blobmsg_get_bool(cur);
 
+	if ((cur = tb[BRIDGE_ATTR_VLAN_FILTERING]))
+		cfg->vlan_filtering = blobmsg_get_bool(cur);
+
 	if ((cur = tb[BRIDGE_ATTR_AGEING_TIME])) {
 		cfg->ageing_time = blobmsg_get_u32(cur);
 		cfg->flags |= BRIDGE_OPT_AGEING_TIME;
@@ -493,6 +982,9 @@ bridge_reload(struct device *dev, struct blob_attr *attr)
 
 		diff = 0;
 		config_diff(tb_dev, otb_dev, &device_attr_list, &diff);
+		diff &= ~((1 << DEV_ATTR_DAMPING_HALFLIFE) |
+			  (1 << DEV_ATTR_DAMPING_SUPPRESS) |
+			  (1 << DEV_ATTR_DAMPING_REUSE));
 		if (diff & ~(1 << DEV_ATTR_IFNAME))
 		    ret = DEV_CONFIG_RESTART;
 
@@ -528,10 +1020,10 @@ bridge_create(const char *name, struct blob_attr *attr)
 	bst->set_state = dev->set_state;
 	dev->set_state = bridge_set_state;
 
-	dev->hotplug_ops = &bridge_ops;
-
 	vlist_init(&bst->members, avl_strcmp, bridge_member_update);
 	bst->members.keep_old = true;
+	INIT_LIST_HEAD(&bst->member_ranges);
+	vlist_init(&bst->vlans, bridge_vlan_cmp, bridge_vlan_tree_update);
 	bridge_reload(dev, attr);
 
 	return dev;
@@ -20,8 +20,10 @@
 #include "netifd.h"
 #include "interface.h"
 #include "interface-ip.h"
+#include "iprule.h"
 #include "proto.h"
 #include "config.h"
+#include "system.h"
 
 bool config_init = false;
 
@@ -231,6 +233,47 @@ config_parse_route(struct uci_section *s, bool v6)
 	interface_ip_add_route(NULL, blob_data(b.head), v6);
 }
 
+static void
+config_parse_rule(struct uci_section *s, bool v6)
+{
+	blob_buf_init(&b, 0);
+	uci_to_blob(&b, s, &rule_attr_list);
+	iprule_add(b.head, v6);
+}
+
+static void
+config_init_bridge_vlans(void)
+{
+	struct uci_element *e;
+	struct device *dev;
+	const char *name;
+
+	device_vlan_update(false);
+
+	uci_foreach_element(&uci_network->sections, e) {
+		struct uci_section *s = uci_to_section(e);
+
+		if (strcmp(s->type, "bridge-vlan") != 0)
+			continue;
+
+		name = uci_lookup_option_string(uci_ctx, s, "device");
+		if (!name)
+			continue;
+
+		dev = device_get(name, false);
+		if (!dev || !dev->type->vlan_add) {
+			D(INTERFACE, "Device '%s' does not support VLAN filtering\n", name);
+			continue;
+		}
+
+		blob_buf_init(&b, 0);
+		uci_to_blob(&b, s, &bridge_vlan_attr_list);
+		dev->type->vlan_add(dev, b.head);
+	}
+
+	device_vlan_update(true);
+}
+
 static void
 config_init_devices(void)
 {
@@ -407,6 +450,7 @@ config_init_routes(void)
 
 	vlist_for_each_element(&interfaces, iface, node)
 		interface_ip_update_start(&iface->config_ip);
+	interface_ip_mp_update_start();
 
 	uci_foreach_element(&uci_network->sections, e) {
 		struct uci_section *s = uci_to_section(e);
@@ -419,11 +463,34 @@ config_init_routes(void)
 
 	vlist_for_each_element(&interfaces, iface, node)
 		interface_ip_update_complete(&iface->config_ip);
+	interface_ip_mp_update_complete();
+}
+
+static void
+config_init_rules(void)
+{
+	struct uci_element *e;
+
+	iprule_update_start();
+
+	uci_foreach_element(&uci_network->sections, e) {
+		struct uci_section *s = uci_to_section(e);
+
+		if (!strcmp(s->type, "rule"))
+			config_parse_rule(s, false);
+		else if (!strcmp(s->type, "rule6"))
+			config_parse_rule(s, true);
+	}
+
+	iprule_update_complete();
 }
 
 void
 config_init_all(void)
 {
+	uint64_t start = system_get_rtime_msec();
+	unsigned int duration;
+
 	uci_network = config_init_package("network");
 	if (!uci_network) {
 		fprintf(stderr, "Failed to load network config\n");
@@ -433,11 +500,14 @@ config_init_all(void)
 	vlist_update(&interfaces);
 	config_init = true;
 	device_lock();
+	system_batch_start();
 
 	device_reset_config();
 	config_init_devices();
 	config_init_interfaces();
+	config_init_bridge_vlans();
 	config_init_routes();
+	config_init_rules();
 
 	config_init = false;
 	device_unlock();
@@ -447,4 +517,11 @@ config_init_all(void)
 	device_free_unused(NULL);
 	vlist_flush(&interfaces);
 	interface_start_pending();
+	system_batch_end();
+
+	duration = system_get_rtime_msec() - start;
+	netifd_stats.config_reloads++;
+	netifd_stats.config_reload_time = duration;
+	if (duration > netifd_stats.config_reload_time_max)
+		netifd_stats.config_reload_time_max = duration;
 }
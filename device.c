@@ -48,6 +48,9 @@ static const struct blobmsg_policy dev_attrs[__DEV_ATTR_MAX] = {
 	[DEV_ATTR_MACADDR] = { "macaddr", BLOBMSG_TYPE_STRING },
 	[DEV_ATTR_TXQUEUELEN] = { "txqueuelen", BLOBMSG_TYPE_INT32 },
 	[DEV_ATTR_ENABLED] = { "enabled", BLOBMSG_TYPE_BOOL },
+	[DEV_ATTR_DAMPING_HALFLIFE] = { "damping_halflife", BLOBMSG_TYPE_INT32 },
+	[DEV_ATTR_DAMPING_SUPPRESS] = { "damping_suppress", BLOBMSG_TYPE_INT32 },
+	[DEV_ATTR_DAMPING_REUSE] = { "damping_reuse", BLOBMSG_TYPE_INT32 },
 };
 
 const struct config_param_list device_attr_list = {
@@ -55,8 +58,55 @@ const struct config_param_list device_attr_list = {
 	.params = dev_attrs,
 };
 
+/*
+ * Flap damping, modelled after BGP route flap damping: every time a device
+ * disappears it gets a penalty, which decays exponentially with the
+ * configured half-life. Once the penalty exceeds the suppress limit, the
+ * device is kept out of the present state until it has decayed below the
+ * reuse limit again.
+ */
+#define DAMPING_PENALTY		1000
+#define DAMPING_SUPPRESS	2000
+#define DAMPING_REUSE		750
+
+/* upper limit for the interval between two penalty checks, in ms */
+#define DAMPING_INTERVAL_MAX	(60 * 1000)
+
+struct device_damping {
+	struct uloop_timeout timeout;
+	struct device *dev;
+
+	unsigned int halflife;
+	unsigned int suppress;
+	unsigned int reuse;
+
+	unsigned int penalty;
+	unsigned int flaps;
+	uint64_t updated;
+	bool suppressed;
+};
+
+/* only simple devices can sit on top of a parent found by the system */
+struct simple_device {
+	struct device dev;
+	struct device_user parent;
+};
+
+static struct obj_pool device_pool = OBJ_POOL("device", struct simple_device);
+
 static int __devlock = 0;
 
+/*
+ * Devices that lose their last user while the list is locked are queued
+ * here and freed from the main loop, instead of sweeping the whole device
+ * list on every unlock
+ */
+static LIST_HEAD(unused_devices);
+static void device_free_queued(struct uloop_timeout *timeout);
+static struct uloop_timeout unused_timeout = {
+	.cb = device_free_queued,
+};
+
 void device_lock(void)
 {
 	__devlock++;
@@ -65,8 +115,8 @@ void device_lock(void)
 void device_unlock(void)
 {
 	__devlock--;
-	if (!__devlock)
-		device_free_unused(NULL);
+	if (!__devlock && !list_empty(&unused_devices))
+		uloop_timeout_set(&unused_timeout, 0);
 }
 
 static int set_device_state(struct device *dev, bool state)
@@ -82,21 +132,23 @@ static int set_device_state(struct device *dev, bool state)
 static int
 simple_device_set_state(struct device *dev, bool state)
 {
+	struct simple_device *sdev;
 	struct device *pdev;
 	int ret = 0;
 
-	pdev = dev->parent.dev;
+	sdev = container_of(dev, struct simple_device, dev);
+	pdev = sdev->parent.dev;
 	if (state && !pdev) {
 		pdev = system_if_get_parent(dev);
 		if (pdev)
-			device_add_user(&dev->parent, pdev);
+			device_add_user(&sdev->parent, pdev);
 	}
 
 	if (pdev) {
 		if (state)
-			ret = device_claim(&dev->parent);
+			ret = device_claim(&sdev->parent);
 		else
-			device_release(&dev->parent);
+			device_release(&sdev->parent);
 
 		if (ret < 0)
 			return ret;
@@ -115,7 +167,9 @@ simple_device_create(const char *name, struct blob_attr *attr)
 	if (!dev)
 		return NULL;
 
-	dev->set_state = simple_device_set_state;
+	/* vlan and alias devices can be configured by name as well */
+	if (dev->type == &simple_device_type)
+		dev->set_state = simple_device_set_state;
 	device_init_settings(dev, tb);
 
 	return dev;
@@ -123,9 +177,12 @@ simple_device_create(const char *name, struct blob_attr *attr)
 
 static void simple_device_free(struct device *dev)
 {
-	if (dev->parent.dev)
-		device_remove_user(&dev->parent);
-	free(dev);
+	struct simple_device *sdev;
+
+	sdev = container_of(dev, struct simple_device, dev);
+	if (sdev->parent.dev)
+		device_remove_user(&sdev->parent);
+	obj_pool_free(&device_pool, sdev);
 }
 
 const struct device_type simple_device_type = {
@@ -201,6 +258,142 @@ device_merge_settings(struct device *dev, struct device_settings *n)
 	n->flags = s->flags | os->flags;
 }
 
+static void
+device_damping_decay(struct device_damping *d)
+{
+	uint64_t now = system_get_rtime_msec();
+	uint64_t halflife = (uint64_t) d->halflife * 1000;
+	uint64_t delta = now - d->updated;
+
+	d->updated = now;
+	if (delta >= halflife * 32) {
+		d->penalty = 0;
+		return;
+	}
+
+	/* halve for every full half-life, approximate the rest linearly */
+	d->penalty >>= delta / halflife;
+	d->penalty -= d->penalty * (delta % halflife) / (2 * halflife);
+}
+
+static int
+device_damping_interval(struct device_damping *d)
+{
+	uint64_t interval = (uint64_t) d->halflife * 1000 / 8;
+
+	if (interval > DAMPING_INTERVAL_MAX)
+		interval = DAMPING_INTERVAL_MAX;
+
+	return interval;
+}
+
+static void
+device_damping_timeout_cb(struct uloop_timeout *t)
+{
+	struct device_damping *d = container_of(t, struct device_damping, timeout);
+
+	device_damping_decay(d);
+	if (d->penalty >= d->reuse) {
+		uloop_timeout_set(t, device_damping_interval(d));
+		return;
+	}
+
+	D(DEVICE, "Device '%s' is stable again, no longer suppressed\n", d->dev->ifname);
+	d->suppressed = false;
+	device_refresh_present(d->dev);
+}
+
+static void
+device_damping_flap(struct device *dev)
+{
+	struct device_damping *d = dev->damping;
+
+	if (!d)
+		return;
+
+	device_damping_decay(d);
+	d->flaps++;
+	d->penalty += DAMPING_PENALTY;
+	if (d->penalty > 4 * d->suppress)
+		d->penalty = 4 * d->suppress;
+
+	if (d->suppressed || d->penalty < d->suppress)
+		return;
+
+	D(DEVICE, "Device '%s' is flapping, suppressing state changes\n", dev->ifname);
+	d->suppressed = true;
+	uloop_timeout_set(&d->timeout, device_damping_interval(d));
+}
+
+static void
+device_free_damping(struct device *dev)
+{
+	if (!dev->damping)
+		return;
+
+	uloop_timeout_cancel(&dev->damping->timeout);
+	free(dev->damping);
+	dev->damping = NULL;
+}
+
+static void
+device_init_damping(struct device *dev, struct blob_attr **tb)
+{
+	struct device_damping *d = dev->damping;
+	struct blob_attr *cur;
+	unsigned int halflife = 0;
+
+	if ((cur = tb[DEV_ATTR_DAMPING_HALFLIFE]))
+		halflife = blobmsg_get_u32(cur);
+
+	if (!halflife) {
+		device_free_damping(dev);
+		return;
+	}
+
+	if (!d) {
+		d = calloc(1, sizeof(*d));
+		if (!d)
+			return;
+
+		d->dev = dev;
+		d->timeout.cb = device_damping_timeout_cb;
+		d->updated = system_get_rtime_msec();
+		dev->damping = d;
+	}
+
+	d->halflife = halflife;
+
+	d->suppress = DAMPING_SUPPRESS;
+	if ((cur = tb[DEV_ATTR_DAMPING_SUPPRESS]))
+		d->suppress = blobmsg_get_u32(cur);
+
+	d->reuse = DAMPING_REUSE;
+	if ((cur = tb[DEV_ATTR_DAMPING_REUSE]))
+		d->reuse = blobmsg_get_u32(cur);
+
+	if (d->reuse >= d->suppress)
+		d->reuse = d->suppress / 2;
+}
+
+static void
+device_dump_damping(struct blob_buf *b, struct device *dev)
+{
+	struct device_damping *d = dev->damping;
+	void *c;
+
+	device_damping_decay(d);
+
+	c = blobmsg_open_table(b, "damping");
+	blobmsg_add_u8(b, "suppressed", d->suppressed);
+	blobmsg_add_u32(b, "penalty", d->penalty);
+	blobmsg_add_u32(b, "flaps", d->flaps);
+	blobmsg_add_u32(b, "halflife", d->halflife);
+	blobmsg_add_u32(b, "suppress", d->suppress);
+	blobmsg_add_u32(b, "reuse", d->reuse);
+	blobmsg_close_table(b, c);
+}
+
 void
 device_init_settings(struct device *dev, struct blob_attr **tb)
 {
@@ -231,6 +424,7 @@ device_init_settings(struct device *dev, struct blob_attr **tb)
 		}
 	}
 
+	device_init_damping(dev, tb);
 	device_set_disabled(dev, disabled);
 }
 
@@ -293,6 +487,14 @@ int device_claim(struct device_user *dep)
 	if (++dev->active != 1)
 		return 0;
 
+	/*
+	 * set_state claims the lower devices first, so a stacked device tree
+	 * is brought up bottom to top. The kernel requests of the whole tree
+	 * and of the users reacting to DEV_EVENT_UP share one batch; replies
+	 * are only collected once a device of the next layer needs the
+	 * ifindex of a lower one, so each layer costs one pass.
+	 */
+	system_batch_start();
 	device_broadcast_event(dev, DEV_EVENT_SETUP);
 	ret = dev->set_state(dev, true);
 	if (ret == 0)
@@ -302,6 +504,7 @@ int device_claim(struct device_user *dep)
 		dev->active = 0;
 		dep->claimed = false;
 	}
+	system_batch_end();
 
 	return ret;
 }
@@ -321,10 +524,12 @@ void device_release(struct device_user *dep)
 	if (dev->active)
 		return;
 
+	system_batch_start();
 	device_broadcast_event(dev, DEV_EVENT_TEARDOWN);
 	if (!dep->hotplug)
 		dev->set_state(dev, false);
 	device_broadcast_event(dev, DEV_EVENT_DOWN);
+	system_batch_end();
 }
 
 int device_check_state(struct device *dev)
@@ -345,6 +550,7 @@ void device_init_virtual(struct device *dev, const struct device_type *type, con
 
 	D(DEVICE, "Initialize device '%s'\n", dev->ifname);
 	INIT_LIST_HEAD(&dev->users);
+	INIT_LIST_HEAD(&dev->unused);
 	dev->type = type;
 }
 
@@ -372,13 +578,18 @@ int device_init(struct device *dev, const struct device_type *type, const char *
 static struct device *
 device_create_default(const char *name, bool external)
 {
+	struct simple_device *sdev;
 	struct device *dev;
 
 	if (!external && system_if_force_external(name))
 		return NULL;
 
 	D(DEVICE, "Create simple device '%s'\n", name);
-	dev = calloc(1, sizeof(*dev));
+	sdev = obj_pool_alloc(&device_pool);
+	if (!sdev)
+		return NULL;
+
+	dev = &sdev->dev;
 	dev->external = external;
 	dev->set_state = simple_device_set_state;
 	device_init(dev, &simple_device_type, name);
@@ -443,6 +654,7 @@ void device_cleanup(struct device *dev)
 		device_release(dep);
 	}
 
+	device_free_damping(dev);
 	device_delete(dev);
 }
 
@@ -463,9 +675,25 @@ device_refresh_present(struct device *dev)
 	if (dev->disabled || dev->deferred)
 		state = false;
 
+	if (dev->damping && dev->damping->suppressed)
+		state = false;
+
 	__device_set_present(dev, state);
 }
 
+/*
+ * cycle the present state of a device to get new settings applied, without
+ * touching the system state (and flap damping) of the device
+ */
+static void device_restart(struct device *dev)
+{
+	if (!dev->present)
+		return;
+
+	__device_set_present(dev, false);
+	device_refresh_present(dev);
+}
+
 void device_set_present(struct device *dev, bool state)
 {
 	if (dev->sys_present == state)
@@ -473,6 +701,8 @@ void device_set_present(struct device *dev, bool state)
 
 	D(DEVICE, "%s '%s' %s present\n", dev->type->name, dev->ifname, state ? "is now" : "is no longer" );
 	dev->sys_present = state;
+	if (!state)
+		device_damping_flap(dev);
 	device_refresh_present(dev);
 }
 
@@ -497,21 +727,47 @@ void
 device_free(struct device *dev)
 {
 	__devlock++;
+	list_del_init(&dev->unused);
 	free(dev->config);
 	device_cleanup(dev);
 	dev->type->free(dev);
 	__devlock--;
+
+	if (!__devlock && !list_empty(&unused_devices))
+		uloop_timeout_set(&unused_timeout, 0);
 }
 
 static void
 __device_free_unused(struct device *dev)
 {
-	if (!list_empty(&dev->users) || dev->current_config || __devlock)
+	if (!list_empty(&dev->users) || dev->current_config)
+		return;
+
+	if (__devlock) {
+		if (list_empty(&dev->unused))
+			list_add_tail(&dev->unused, &unused_devices);
 		return;
+	}
 
 	device_free(dev);
 }
 
+static void
+device_free_queued(struct uloop_timeout *timeout)
+{
+	struct device *dev;
+
+	if (__devlock)
+		return;
+
+	/* freeing a device can queue its lower devices */
+	while (!list_empty(&unused_devices)) {
+		dev = list_first_entry(&unused_devices, struct device, unused);
+		list_del_init(&dev->unused);
+		__device_free_unused(dev);
+	}
+}
+
 void device_remove_user(struct device_user *dep)
 {
 	struct device *dev = dep->dev;
@@ -618,10 +874,36 @@ device_reset_config(void)
 		dev->current_config = false;
 }
 
+/*
+ * Return a simple device whose config section disappeared to the default
+ * config in place. Users stay attached; the device only goes through a
+ * down/up cycle if settings were applied that need to be undone.
+ */
+static void
+device_reset_default(struct device *dev)
+{
+	struct blob_attr *tb[__DEV_ATTR_MAX];
+	bool restart = dev->active && dev->settings.flags;
+
+	D(DEVICE, "Device '%s': reset to default config\n", dev->ifname);
+
+	/* the original settings are restored while the old flags are known */
+	if (restart)
+		__device_set_present(dev, false);
+
+	free(dev->config);
+	dev->config = NULL;
+	dev->default_config = true;
+
+	memset(tb, 0, sizeof(tb));
+	device_init_settings(dev, tb);
+	device_refresh_present(dev);
+}
+
 void
 device_reset_old(void)
 {
-	struct device *dev, *tmp, *ndev;
+	struct device *dev, *tmp;
 
 	avl_for_each_element_safe(&devices, dev, avl, tmp) {
 		if (dev->current_config || dev->default_config)
@@ -630,8 +912,20 @@ device_reset_old(void)
 		if (dev->type != &simple_device_type)
 			continue;
 
-		ndev = device_create_default(dev->ifname, dev->external);
-		device_replace(ndev, dev);
+		device_reset_default(dev);
+	}
+}
+
+void
+device_vlan_update(bool flush)
+{
+	struct device *dev;
+
+	avl_for_each_element(&devices, dev, avl) {
+		if (!dev->type->vlan_update)
+			continue;
+
+		dev->type->vlan_update(dev, flush);
 	}
 }
 
@@ -656,10 +950,8 @@ device_create(const char *name, const struct device_type *type,
 			D(DEVICE, "Device '%s': config applied\n", odev->ifname);
 			free(odev->config);
 			odev->config = config;
-			if (change == DEV_CONFIG_RESTART && odev->present) {
-				device_set_present(odev, false);
-				device_set_present(odev, true);
-			}
+			if (change == DEV_CONFIG_RESTART)
+				device_restart(odev);
 			return odev;
 		case DEV_CONFIG_NO_CHANGE:
 			D(DEVICE, "Device '%s': no configuration change\n", odev->ifname);
@@ -696,7 +988,8 @@ device_dump_status(struct blob_buf *b, struct device *dev)
 
 	if (!dev) {
 		avl_for_each_element(&devices, dev, avl) {
-			if (!dev->present)
+			if (!dev->present &&
+			    !(dev->damping && dev->damping->suppressed))
 				continue;
 			c = blobmsg_open_table(b, dev->ifname);
 			device_dump_status(b, dev);
@@ -710,6 +1003,9 @@ device_dump_status(struct blob_buf *b, struct device *dev)
 	blobmsg_add_u8(b, "present", dev->present);
 	blobmsg_add_string(b, "type", dev->type->name);
 
+	if (dev->damping)
+		device_dump_damping(b, dev);
+
 	if (!dev->present)
 		return;
 
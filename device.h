@@ -20,6 +20,7 @@
 struct device;
 struct device_user;
 struct device_hotplug_ops;
+struct device_damping;
 
 typedef int (*device_state_cb)(struct device *, bool up);
 
@@ -30,6 +31,9 @@ enum {
 	DEV_ATTR_MACADDR,
 	DEV_ATTR_TXQUEUELEN,
 	DEV_ATTR_ENABLED,
+	DEV_ATTR_DAMPING_HALFLIFE,
+	DEV_ATTR_DAMPING_SUPPRESS,
+	DEV_ATTR_DAMPING_REUSE,
 	__DEV_ATTR_MAX,
 };
 
@@ -53,6 +57,13 @@ struct device_type {
 	void (*dump_stats)(struct device *, struct blob_buf *buf);
 	int (*check_state)(struct device *);
 	void (*free)(struct device *);
+
+	/* VLAN membership configured through bridge-vlan sections */
+	int (*vlan_add)(struct device *, struct blob_attr *);
+	void (*vlan_update)(struct device *, bool flush);
+
+	/* devices that take hotplug members */
+	const struct device_hotplug_ops *hotplug_ops;
 };
 
 enum {
@@ -100,35 +111,38 @@ struct device_settings {
  * can be used to support VLANs as well
  */
 struct device {
-	const struct device_type *type;
-
+	/* fields used when walking the device list come first */
 	struct avl_node avl;
+	const struct device_type *type;
 	struct list_head users;
 
-	char ifname[IFNAMSIZ + 1];
+	int active;
 	int ifindex;
 
-	struct blob_attr *config;
 	bool config_pending;
 	bool sys_present;
 	bool present;
-	int active;
 	bool external;
 	bool disabled;
 	bool deferred;
-
 	bool current_config;
 	bool default_config;
 
+	struct blob_attr *config;
+
 	/* set interface up or down */
 	device_state_cb set_state;
 
-	const struct device_hotplug_ops *hotplug_ops;
-
-	struct device_user parent;
+	char ifname[IFNAMSIZ + 1];
 
 	struct device_settings orig_settings;
 	struct device_settings settings;
+
+	/* flap damping state, only allocated if configured */
+	struct device_damping *damping;
+
+	/* queued for removal while the device list was locked */
+	struct list_head unused;
 };
 
 struct device_hotplug_ops {
@@ -138,6 +152,7 @@ struct device_hotplug_ops {
 };
 
 extern const struct config_param_list device_attr_list;
+extern const struct config_param_list bridge_vlan_attr_list;
 extern const struct device_type simple_device_type;
 extern const struct device_type bridge_device_type;
 extern const struct device_type tunnel_device_type;
@@ -156,6 +171,7 @@ device_set_config(struct device *dev, const struct device_type *type,
 
 void device_reset_config(void);
 void device_reset_old(void);
+void device_vlan_update(bool flush);
 
 void device_init_virtual(struct device *dev, const struct device_type *type, const char *name);
 int device_init(struct device *iface, const struct device_type *type, const char *ifname);
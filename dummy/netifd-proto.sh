@@ -50,6 +50,9 @@ proto_init_update() {
 	PROTO_IP6ADDR=
 	PROTO_ROUTE=
 	PROTO_ROUTE6=
+	PROTO_ROUTE_SET=
+	PROTO_ROUTE6_SET=
+	PROTO_ROUTE_SETS=0
 	PROTO_DNS=
 	PROTO_DNS_SEARCH=
 	json_init
@@ -133,6 +136,31 @@ proto_add_ipv6_route() {
 	jshn_append PROTO_ROUTE6 "$target/$mask/$gw"
 }
 
+# <list> <gateway> <metric> <table> <target>...
+_proto_add_route_set() {
+	local list="$1"
+	local set="$PROTO_ROUTE_SETS"
+
+	PROTO_ROUTE_SETS="$(($PROTO_ROUTE_SETS + 1))"
+	eval "PROTO_ROUTE_SET_GW_$set=\"\$2\""
+	eval "PROTO_ROUTE_SET_METRIC_$set=\"\$3\""
+	eval "PROTO_ROUTE_SET_TABLE_$set=\"\$4\""
+	shift 4
+	eval "PROTO_ROUTE_SET_TARGETS_$set=\"\$*\""
+	jshn_append "$list" "$set"
+}
+
+# Add many routes that share gateway, metric and table with a single
+# entry. Gateway, metric and table may be empty, every further argument
+# is a target in "address[/mask]" form.
+proto_add_ipv4_route_set() {
+	_proto_add_route_set PROTO_ROUTE_SET "$@"
+}
+
+proto_add_ipv6_route_set() {
+	_proto_add_route_set PROTO_ROUTE6_SET "$@"
+}
+
 _proto_push_ipv4_addr() {
 	local str="$1"
 	local address mask broadcast ptp
@@ -185,6 +213,27 @@ _proto_push_route() {
 	json_close_object
 }
 
+_proto_push_route_set() {
+	local set="$1"
+	local gw metric table targets target
+
+	eval "gw=\"\$PROTO_ROUTE_SET_GW_$set\""
+	eval "metric=\"\$PROTO_ROUTE_SET_METRIC_$set\""
+	eval "table=\"\$PROTO_ROUTE_SET_TABLE_$set\""
+	eval "targets=\"\$PROTO_ROUTE_SET_TARGETS_$set\""
+
+	json_add_object ""
+	json_add_array targets
+	for target in $targets; do
+		json_add_string "" "$target"
+	done
+	json_close_array
+	[ -n "$gw" ] && json_add_string gateway "$gw"
+	[ -n "$metric" ] && json_add_int metric "$metric"
+	[ -n "$table" ] && json_add_string table "$table"
+	json_close_object
+}
+
 _proto_push_array() {
 	local name="$1"
 	local val="$2"
@@ -201,7 +250,8 @@ _proto_push_array() {
 _proto_notify() {
 	local interface="$1"
 	local options="$2"
-	ubus $options call network.interface."$interface" notify_proto "$(json_dump)"
+	json_add_string interface "$interface"
+	ubus $options call network.interface notify_proto "$(json_dump)"
 }
 
 proto_send_update() {
@@ -213,6 +263,8 @@ proto_send_update() {
 	_proto_push_array "ip6addr" "$PROTO_IP6ADDR" _proto_push_ipv6_addr
 	_proto_push_array "routes" "$PROTO_ROUTE" _proto_push_route
 	_proto_push_array "routes6" "$PROTO_ROUTE6" _proto_push_route
+	_proto_push_array "routes-bulk" "$PROTO_ROUTE_SET" _proto_push_route_set
+	_proto_push_array "routes6-bulk" "$PROTO_ROUTE6_SET" _proto_push_route_set
 	_proto_push_array "dns" "$PROTO_DNS" _proto_push_string
 	_proto_push_array "dns_search" "$PROTO_DNS_SEARCH" _proto_push_string
 	_proto_notify "$interface"
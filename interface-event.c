@@ -38,6 +38,7 @@ run_cmd(const char *ifname, const char *device, bool up)
 	char *argv[3];
 	int pid;
 
+	netifd_stats.forks++;
 	pid = fork();
 	if (pid < 0)
 		return task_complete(NULL, -1);
@@ -80,8 +81,11 @@ call_hotplug(void)
 static void
 task_complete(struct uloop_process *proc, int ret)
 {
-	if (current)
+	if (current) {
 		D(SYSTEM, "Complete hotplug handler for interface '%s'\n", current->name);
+		if (current_ev == IFEV_UP)
+			interface_timing_mark(current, IFT_HOTPLUG_DONE);
+	}
 	current = NULL;
 	call_hotplug();
 }
@@ -137,6 +141,8 @@ static void interface_event_cb(struct interface_user *dep, struct interface *ifa
 		case IFEV_RELOAD:
 			interface_dequeue_event(iface);
 			break;
+		case IFEV_UPDATE:
+			break;
 	}
 }
 
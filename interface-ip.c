@@ -33,6 +33,8 @@ enum {
 	ROUTE_GATEWAY,
 	ROUTE_METRIC,
 	ROUTE_MTU,
+	ROUTE_TABLE,
+	ROUTE_NEXTHOP,
 	__ROUTE_MAX
 };
 
@@ -43,13 +45,55 @@ static const struct blobmsg_policy route_attr[__ROUTE_MAX] = {
 	[ROUTE_GATEWAY] = { .name = "gateway", .type = BLOBMSG_TYPE_STRING },
 	[ROUTE_METRIC] = { .name = "metric", .type = BLOBMSG_TYPE_INT32 },
 	[ROUTE_MTU] = { .name = "mtu", .type = BLOBMSG_TYPE_INT32 },
+	[ROUTE_TABLE] = { .name = "table", .type = BLOBMSG_TYPE_STRING },
+	[ROUTE_NEXTHOP] = { .name = "nexthop", .type = BLOBMSG_TYPE_ARRAY },
+};
+
+static const union config_param_info route_attr_info[__ROUTE_MAX] = {
+	[ROUTE_NEXTHOP] = { .type = BLOBMSG_TYPE_STRING },
 };
 
 const struct config_param_list route_attr_list = {
 	.n_params = __ROUTE_MAX,
 	.params = route_attr,
+	.info = route_attr_info,
+};
+
+enum {
+	ROUTE_SET_TARGETS,
+	ROUTE_SET_GATEWAY,
+	ROUTE_SET_METRIC,
+	ROUTE_SET_MTU,
+	ROUTE_SET_TABLE,
+	__ROUTE_SET_MAX
+};
+
+static const struct blobmsg_policy route_set_attr[__ROUTE_SET_MAX] = {
+	[ROUTE_SET_TARGETS] = { .name = "targets", .type = BLOBMSG_TYPE_ARRAY },
+	[ROUTE_SET_GATEWAY] = { .name = "gateway", .type = BLOBMSG_TYPE_STRING },
+	[ROUTE_SET_METRIC] = { .name = "metric", .type = BLOBMSG_TYPE_INT32 },
+	[ROUTE_SET_MTU] = { .name = "mtu", .type = BLOBMSG_TYPE_INT32 },
+	[ROUTE_SET_TABLE] = { .name = "table", .type = BLOBMSG_TYPE_STRING },
+};
+
+/* addresses and routes are churned on every protocol update */
+static struct obj_pool addr_pool[2] = {
+	OBJ_POOL("addr4", struct device_addr),
+	OBJ_POOL("addr6", struct device_addr),
+};
+
+static struct obj_pool route_pool[2] = {
+	OBJ_POOL("route4", struct device_route),
+	OBJ_POOL("route6", struct device_route),
 };
 
+static struct vlist_tree mp_routes;
+static struct interface_user mp_route_user;
+
+/* delegated prefixes of all interfaces */
+LIST_HEAD(prefixes);
+static struct interface_user prefix_user;
+
 static void
 clear_if_addr(union if_addr *a, int mask)
 {
@@ -57,10 +101,11 @@ clear_if_addr(union if_addr *a, int mask)
 	uint8_t m_clear = (1 << (m_bytes * 8 - mask)) - 1;
 	uint8_t *p = (uint8_t *) a;
 
-	if (m_bytes < sizeof(a))
-		memset(p + m_bytes, 0, sizeof(a) - m_bytes);
+	if (m_bytes < sizeof(*a))
+		memset(p + m_bytes, 0, sizeof(*a) - m_bytes);
 
-	p[m_bytes - 1] &= ~m_clear;
+	if (m_bytes)
+		p[m_bytes - 1] &= ~m_clear;
 }
 
 static bool
@@ -142,11 +187,10 @@ interface_ip_add_target_route(union if_addr *addr, bool v6)
 	struct interface *iface;
 	struct device_route *route, *r_next = NULL;
 
-	route = calloc(1, sizeof(*route));
+	route = interface_ip_alloc_route(v6);
 	if (!route)
-		return false;
+		return NULL;
 
-	route->flags = v6 ? DEVADDR_INET6 : DEVADDR_INET4;
 	route->mask = v6 ? 128 : 32;
 	memcpy(&route->addr, addr, v6 ? sizeof(addr->in6) : sizeof(addr->in));
 
@@ -160,8 +204,10 @@ interface_ip_add_target_route(union if_addr *addr, bool v6)
 		interface_ip_find_route_target(iface, addr, v6, &r_next);
 	}
 
-	if (!r_next)
+	if (!r_next) {
+		interface_ip_free_route(route);
 		return NULL;
+	}
 
 	iface = r_next->iface;
 	memcpy(&route->nexthop, &r_next->nexthop, sizeof(route->nexthop));
@@ -170,10 +216,126 @@ interface_ip_add_target_route(union if_addr *addr, bool v6)
 
 done:
 	route->iface = iface;
-	vlist_add(&iface->host_routes, &route->node, &route->flags);
+	vlist_add(&iface->host_routes, &route->node, &route->table);
 	return iface;
 }
 
+/*
+ * Nexthops of multipath routes are configured as
+ * "<interface> [via <gateway>] [weight <n>]"
+ */
+static bool
+interface_ip_parse_nexthop(const char *str, struct route_nexthop *nh,
+			   char *name_buf, bool v6)
+{
+	char *buf, *name, *key, *val, *err;
+
+	buf = alloca(strlen(str) + 1);
+	strcpy(buf, str);
+
+	name = strtok(buf, " \t");
+	if (!name)
+		return false;
+
+	nh->name = strcpy(name_buf, name);
+	nh->weight = 1;
+
+	while ((key = strtok(NULL, " \t")) != NULL) {
+		val = strtok(NULL, " \t");
+		if (!val)
+			return false;
+
+		if (!strcmp(key, "via")) {
+			if (!inet_pton(v6 ? AF_INET6 : AF_INET, val, &nh->gw))
+				return false;
+		} else if (!strcmp(key, "weight")) {
+			nh->weight = strtoul(val, &err, 0);
+			if (*err || nh->weight < 1 || nh->weight > 256)
+				return false;
+		} else {
+			return false;
+		}
+	}
+
+	return true;
+}
+
+static void
+interface_ip_add_mp_route(struct blob_attr **tb, bool v6)
+{
+	struct device_mp_route *route;
+	struct blob_attr *cur;
+	int af = v6 ? AF_INET6 : AF_INET;
+	int n = 0, rem;
+	size_t len = 0;
+	char *name_buf;
+
+	blobmsg_for_each_attr(cur, tb[ROUTE_NEXTHOP], rem) {
+		if (blobmsg_type(cur) != BLOBMSG_TYPE_STRING ||
+		    !blobmsg_check_attr(cur, NULL))
+			continue;
+
+		/* the interface names are never longer than the option */
+		len += strlen(blobmsg_data(cur)) + 1;
+		n++;
+	}
+
+	if (!n)
+		return;
+
+	route = calloc(1, sizeof(*route) + n * sizeof(route->nexthops[0]) + len);
+	if (!route)
+		return;
+
+	name_buf = (char *) &route->nexthops[n];
+	blobmsg_for_each_attr(cur, tb[ROUTE_NEXTHOP], rem) {
+		struct route_nexthop *nh = &route->nexthops[route->n_nexthops];
+
+		if (blobmsg_type(cur) != BLOBMSG_TYPE_STRING ||
+		    !blobmsg_check_attr(cur, NULL))
+			continue;
+
+		if (!interface_ip_parse_nexthop(blobmsg_data(cur), nh, name_buf, v6)) {
+			DPRINTF("Failed to parse route nexthop: %s\n", (char *) blobmsg_data(cur));
+			goto error;
+		}
+
+		name_buf += strlen(name_buf) + 1;
+		route->n_nexthops++;
+	}
+
+	route->flags = v6 ? DEVADDR_INET6 : DEVADDR_INET4;
+	route->mask = v6 ? 128 : 32;
+	if ((cur = tb[ROUTE_MASK]) != NULL) {
+		route->mask = parse_netmask_string(blobmsg_data(cur), v6);
+		if (route->mask > (v6 ? 128 : 32))
+			goto error;
+	}
+
+	if ((cur = tb[ROUTE_TARGET]) != NULL) {
+		if (!inet_pton(af, blobmsg_data(cur), &route->addr)) {
+			DPRINTF("Failed to parse route target: %s\n", (char *) blobmsg_data(cur));
+			goto error;
+		}
+	}
+
+	if ((cur = tb[ROUTE_METRIC]) != NULL)
+		route->metric = blobmsg_get_u32(cur);
+
+	if ((cur = tb[ROUTE_TABLE]) != NULL) {
+		if (!system_resolve_rt_table(blobmsg_data(cur), &route->table)) {
+			DPRINTF("Failed to resolve routing table: %s\n", (char *) blobmsg_data(cur));
+			goto error;
+		}
+	}
+
+	vlist_add(&mp_routes, &route->node, &route->table);
+	return;
+
+error:
+	free(route);
+}
+
 void
 interface_ip_add_route(struct interface *iface, struct blob_attr *attr, bool v6)
 {
@@ -185,6 +347,17 @@ interface_ip_add_route(struct interface *iface, struct blob_attr *attr, bool v6)
 	blobmsg_parse(route_attr, __ROUTE_MAX, tb, blobmsg_data(attr), blobmsg_data_len(attr));
 
 	if (!iface) {
+		/* routes across several interfaces are tracked separately */
+		if (tb[ROUTE_NEXTHOP] && tb[ROUTE_INTERFACE]) {
+			DPRINTF("Route with both interface and nexthop options, ignoring\n");
+			return;
+		}
+
+		if (tb[ROUTE_NEXTHOP]) {
+			interface_ip_add_mp_route(tb, v6);
+			return;
+		}
+
 		if ((cur = tb[ROUTE_INTERFACE]) == NULL)
 			return;
 
@@ -197,11 +370,10 @@ interface_ip_add_route(struct interface *iface, struct blob_attr *attr, bool v6)
 		ip = &iface->proto_ip;
 	}
 
-	route = calloc(1, sizeof(*route));
+	route = interface_ip_alloc_route(v6);
 	if (!route)
 		return;
 
-	route->flags = v6 ? DEVADDR_INET6 : DEVADDR_INET4;
 	route->mask = v6 ? 128 : 32;
 	if ((cur = tb[ROUTE_MASK]) != NULL) {
 		route->mask = parse_netmask_string(blobmsg_data(cur), v6);
@@ -231,11 +403,137 @@ interface_ip_add_route(struct interface *iface, struct blob_attr *attr, bool v6)
 	if ((cur = tb[ROUTE_MTU]) != NULL)
 		route->mtu = blobmsg_get_u32(cur);
 
-	vlist_add(&ip->route, &route->node, &route->flags);
+	if ((cur = tb[ROUTE_TABLE]) != NULL) {
+		if (!system_resolve_rt_table(blobmsg_data(cur), &route->table)) {
+			DPRINTF("Failed to resolve routing table: %s\n", (char *) blobmsg_data(cur));
+			goto error;
+		}
+	} else {
+		route->table = interface_ip_table(iface, v6);
+	}
+
+	vlist_add(&ip->route, &route->node, &route->table);
 	return;
 
 error:
-	free(route);
+	interface_ip_free_route(route);
+}
+
+static void
+interface_ip_add_route_prefix(struct interface_ip_settings *ip,
+			      struct device_route *tmpl, const void *addr,
+			      unsigned int mask, bool v6)
+{
+	struct device_route *route;
+
+	route = interface_ip_alloc_route(v6);
+	if (!route)
+		return;
+
+	memcpy(route, tmpl, sizeof(*route));
+	memcpy(&route->addr, addr, v6 ? sizeof(route->addr.in6) : sizeof(route->addr.in));
+	route->mask = mask;
+	vlist_add(&ip->route, &route->node, &route->table);
+}
+
+/*
+ * Add a set of routes sharing gateway, metric and table. The targets are
+ * an array of "address[/mask]" strings. Unlike interface_ip_add_route, the
+ * attributes are only parsed once per set.
+ */
+void
+interface_ip_add_route_set(struct interface *iface, struct blob_attr *attr, bool v6)
+{
+	struct interface_ip_settings *ip = &iface->proto_ip;
+	struct blob_attr *tb[__ROUTE_SET_MAX], *cur;
+	struct device_route tmpl;
+	union if_addr addr;
+	unsigned int mask;
+	int af = v6 ? AF_INET6 : AF_INET;
+	int rem;
+
+	blobmsg_parse(route_set_attr, __ROUTE_SET_MAX, tb, blobmsg_data(attr), blobmsg_data_len(attr));
+	if (!tb[ROUTE_SET_TARGETS])
+		return;
+
+	memset(&tmpl, 0, sizeof(tmpl));
+	tmpl.flags = v6 ? DEVADDR_INET6 : DEVADDR_INET4;
+
+	if ((cur = tb[ROUTE_SET_GATEWAY]) != NULL) {
+		if (!inet_pton(af, blobmsg_data(cur), &tmpl.nexthop)) {
+			DPRINTF("Failed to parse route gateway: %s\n", (char *) blobmsg_data(cur));
+			return;
+		}
+	}
+
+	if ((cur = tb[ROUTE_SET_METRIC]) != NULL) {
+		tmpl.metric = blobmsg_get_u32(cur);
+		tmpl.flags |= DEVROUTE_METRIC;
+	}
+
+	if ((cur = tb[ROUTE_SET_MTU]) != NULL)
+		tmpl.mtu = blobmsg_get_u32(cur);
+
+	if ((cur = tb[ROUTE_SET_TABLE]) != NULL) {
+		if (!system_resolve_rt_table(blobmsg_data(cur), &tmpl.table)) {
+			DPRINTF("Failed to resolve routing table: %s\n", (char *) blobmsg_data(cur));
+			return;
+		}
+	} else {
+		tmpl.table = interface_ip_table(iface, v6);
+	}
+
+	blobmsg_for_each_attr(cur, tb[ROUTE_SET_TARGETS], rem) {
+		if (blobmsg_type(cur) != BLOBMSG_TYPE_STRING)
+			continue;
+
+		mask = v6 ? 128 : 32;
+		if (!parse_ip_and_netmask(af, blobmsg_data(cur), &addr, &mask)) {
+			DPRINTF("Failed to parse route target: %s\n", (char *) blobmsg_data(cur));
+			continue;
+		}
+
+		clear_if_addr(&addr, mask);
+		interface_ip_add_route_prefix(ip, &tmpl, &addr, mask, v6);
+	}
+}
+
+struct device_addr *
+interface_ip_alloc_addr(bool v6)
+{
+	struct device_addr *addr;
+
+	addr = obj_pool_alloc(&addr_pool[v6]);
+	if (addr)
+		addr->flags = v6 ? DEVADDR_INET6 : DEVADDR_INET4;
+
+	return addr;
+}
+
+void
+interface_ip_free_addr(struct device_addr *addr)
+{
+	if (addr)
+		obj_pool_free(&addr_pool[addr->flags & DEVADDR_FAMILY], addr);
+}
+
+struct device_route *
+interface_ip_alloc_route(bool v6)
+{
+	struct device_route *route;
+
+	route = obj_pool_alloc(&route_pool[v6]);
+	if (route)
+		route->flags = v6 ? DEVADDR_INET6 : DEVADDR_INET4;
+
+	return route;
+}
+
+void
+interface_ip_free_route(struct device_route *route)
+{
+	if (route)
+		obj_pool_free(&route_pool[route->flags & DEVADDR_FAMILY], route);
 }
 
 static int
@@ -245,11 +543,39 @@ addr_cmp(const void *k1, const void *k2, void *ptr)
 		      offsetof(struct device_addr, flags));
 }
 
+static int
+prefix_cmp(const void *k1, const void *k2, void *ptr)
+{
+	return memcmp(k1, k2, sizeof(struct device_prefix) -
+		      offsetof(struct device_prefix, length));
+}
+
 static int
 route_cmp(const void *k1, const void *k2, void *ptr)
 {
 	return memcmp(k1, k2, sizeof(struct device_route) -
-		      offsetof(struct device_route, flags));
+		      offsetof(struct device_route, table));
+}
+
+unsigned int
+interface_ip_table(struct interface *iface, bool v6)
+{
+	return v6 ? iface->ip6table : iface->ip4table;
+}
+
+static void
+interface_subnet_route_init(struct device_route *route, struct interface *iface,
+			    struct device_addr *addr)
+{
+	bool v6 = (addr->flags & DEVADDR_FAMILY) == DEVADDR_INET6;
+
+	memset(route, 0, sizeof(*route));
+	route->iface = iface;
+	route->table = interface_ip_table(iface, v6);
+	route->flags = addr->flags;
+	route->mask = addr->mask;
+	memcpy(&route->addr, &addr->addr, sizeof(route->addr));
+	clear_if_addr(&route->addr, route->mask);
 }
 
 static void
@@ -258,17 +584,16 @@ interface_handle_subnet_route(struct interface *iface, struct device_addr *addr,
 	struct device *dev = iface->l3_dev.dev;
 	struct device_route route;
 
-	route.iface = iface;
-	route.flags = addr->flags;
-	route.mask = addr->mask;
-	memcpy(&route.addr, &addr->addr, sizeof(route.addr));
-	clear_if_addr(&route.addr, route.mask);
+	interface_subnet_route_init(&route, iface, addr);
 
 	if (add) {
-		route.flags |= DEVADDR_KERNEL;
-		system_del_route(dev, &route);
+		/* the kernel prefix route stays in the main table */
+		if (!route.table) {
+			route.flags |= DEVADDR_KERNEL;
+			system_del_route(dev, &route);
+			route.flags &= ~DEVADDR_KERNEL;
+		}
 
-		route.flags &= ~DEVADDR_KERNEL;
 		route.metric = iface->metric;
 		system_add_route(dev, &route);
 	} else {
@@ -276,6 +601,27 @@ interface_handle_subnet_route(struct interface *iface, struct device_addr *addr,
 	}
 }
 
+static void
+interface_add_address(struct interface *iface, struct device *dev,
+		      struct device_addr *addr)
+{
+	struct device_route route;
+
+	interface_subnet_route_init(&route, iface, addr);
+
+	/* skip the kernel prefix route if it is replaced by one with a metric */
+	if (iface->metric && !route.table &&
+	    !system_add_address_noprefixroute(dev, addr)) {
+		route.metric = iface->metric;
+		system_add_route(dev, &route);
+		return;
+	}
+
+	system_add_address(dev, addr);
+	if (iface->metric || route.table)
+		interface_handle_subnet_route(iface, addr, true);
+}
+
 static void
 interface_update_proto_addr(struct vlist_tree *tree,
 			    struct vlist_node *node_new,
@@ -323,17 +669,20 @@ interface_update_proto_addr(struct vlist_tree *tree,
 		if (!(a_old->flags & DEVADDR_EXTERNAL) && a_old->enabled && !keep) {
 			interface_handle_subnet_route(iface, a_old, false);
 			system_del_address(dev, a_old);
+
+			/* the kernel reports the delete, ignore it for repairs */
+			if (a_new)
+				a_new->reprogrammed = true;
+		} else if (a_new) {
+			a_new->reprogrammed = a_old->reprogrammed;
 		}
-		free(a_old);
+		interface_ip_free_addr(a_old);
 	}
 
 	if (node_new) {
 		a_new->enabled = true;
-		if (!(a_new->flags & DEVADDR_EXTERNAL) && !keep) {
-			system_add_address(dev, a_new);
-			if (iface->metric)
-				interface_handle_subnet_route(iface, a_new, true);
-		}
+		if (!(a_new->flags & DEVADDR_EXTERNAL) && !keep)
+			interface_add_address(iface, dev, a_new);
 	}
 }
 
@@ -370,7 +719,7 @@ interface_update_proto_route(struct vlist_tree *tree,
 	if (node_old) {
 		if (!(route_old->flags & DEVADDR_EXTERNAL) && route_old->enabled && !keep)
 			system_del_route(dev, route_old);
-		free(route_old);
+		interface_ip_free_route(route_old);
 	}
 
 	if (node_new) {
@@ -404,87 +753,534 @@ interface_update_host_route(struct vlist_tree *tree,
 
 	if (node_old) {
 		system_del_route(dev, route_old);
-		free(route_old);
+		interface_ip_free_route(route_old);
 	}
 
 	if (node_new)
 		system_add_route(dev, route_new);
 }
 
-void
-interface_add_dns_server(struct interface_ip_settings *ip, const char *str)
+/*
+ * Prefix delegation
+ *
+ * Prefixes delegated to an upstream interface are split into subnets of
+ * ip6assign bits for every downstream interface that is up. Each
+ * downstream interface keeps its subnet for as long as the prefix exists,
+ * ip6hint selects the preferred subnet id. The router address of the
+ * subnet is added to the config settings of the downstream interface.
+ */
+static void
+interface_prefix_subnet(struct device_prefix *prefix, unsigned int length,
+			uint32_t id, union if_addr *subnet)
 {
-	struct dns_server *s;
+	unsigned int bits = length - prefix->length;
+	unsigned int i, bit;
 
-	s = calloc(1, sizeof(*s));
-	s->af = AF_INET;
-	if (inet_pton(s->af, str, &s->addr.in))
-		goto add;
-
-	s->af = AF_INET6;
-	if (inet_pton(s->af, str, &s->addr.in))
-		goto add;
+	memset(subnet, 0, sizeof(*subnet));
+	memcpy(&subnet->in6, &prefix->addr, sizeof(subnet->in6));
+	clear_if_addr(subnet, prefix->length);
 
-	free(s);
-	return;
+	for (i = 0; i < bits; i++) {
+		if (!(id & (1U << (bits - 1 - i))))
+			continue;
 
-add:
-	D(INTERFACE, "Add IPv%c DNS server: %s\n",
-	  s->af == AF_INET6 ? '6' : '4', str);
-	vlist_simple_add(&ip->dns_servers, &s->node);
+		bit = prefix->length + i;
+		subnet->in6.s6_addr[bit / 8] |= 0x80 >> (bit % 8);
+	}
 }
 
-void
-interface_add_dns_server_list(struct interface_ip_settings *ip, struct blob_attr *list)
+static struct device_prefix_assignment *
+interface_prefix_find_assignment(struct device_prefix *prefix, const char *name)
 {
-	struct blob_attr *cur;
-	int rem;
+	struct device_prefix_assignment *a;
 
-	blobmsg_for_each_attr(cur, list, rem) {
-		if (blobmsg_type(cur) != BLOBMSG_TYPE_STRING)
-			continue;
+	list_for_each_entry(a, &prefix->assignments, head) {
+		if (!strcmp(a->name, name))
+			return a;
+	}
 
-		if (!blobmsg_check_attr(cur, NULL))
-			continue;
+	return NULL;
+}
 
-		interface_add_dns_server(ip, blobmsg_data(cur));
+static bool
+interface_prefix_in_use(struct device_prefix *prefix, union if_addr *subnet,
+			unsigned int length)
+{
+	struct device_prefix_assignment *a;
+
+	list_for_each_entry(a, &prefix->assignments, head) {
+		if (match_if_addr(&a->subnet, subnet,
+				  a->length < length ? a->length : length))
+			return true;
 	}
+
+	return false;
 }
 
 static void
-interface_add_dns_search_domain(struct interface_ip_settings *ip, const char *str)
+interface_prefix_addr_init(struct device_addr *addr,
+			   struct device_prefix_assignment *a)
 {
-	struct dns_search_domain *s;
-	int len = strlen(str);
-
-	s = calloc(1, sizeof(*s) + len + 1);
-	if (!s)
-		return;
-
-	D(INTERFACE, "Add DNS search domain: %s\n", str);
-	memcpy(s->name, str, len);
-	vlist_simple_add(&ip->dns_search, &s->node);
+	memset(addr, 0, sizeof(*addr));
+	addr->flags = DEVADDR_INET6;
+	addr->mask = a->length;
+	memcpy(&addr->addr, &a->subnet, sizeof(addr->addr));
+	addr->addr.in6.s6_addr[15] |= 1;
 }
 
-void
-interface_add_dns_search_list(struct interface_ip_settings *ip, struct blob_attr *list)
+static void
+interface_prefix_install(struct interface *iface,
+			 struct device_prefix_assignment *a)
 {
-	struct blob_attr *cur;
-	int rem;
+	struct device_addr *addr;
 
-	blobmsg_for_each_attr(cur, list, rem) {
-		if (blobmsg_type(cur) != BLOBMSG_TYPE_STRING)
-			continue;
+	addr = interface_ip_alloc_addr(true);
+	if (!addr)
+		return;
 
-		if (!blobmsg_check_attr(cur, NULL))
-			continue;
+	interface_prefix_addr_init(addr, a);
+	vlist_add(&iface->config_ip.addr, &addr->node, &addr->flags);
 
-		interface_add_dns_search_domain(ip, blobmsg_data(cur));
+	/* survives config reloads, which only refresh configured entries */
+	addr->node.version = -1;
+}
+
+static void
+interface_prefix_unassign(struct device_prefix *prefix,
+			  struct device_prefix_assignment *a)
+{
+	struct interface *iface;
+	struct device_addr key, *addr;
+
+	iface = vlist_find(&interfaces, a->name, iface, node);
+	if (iface) {
+		interface_prefix_addr_init(&key, a);
+		addr = vlist_find(&iface->config_ip.addr, &key.flags, addr, node);
+		if (addr)
+			vlist_delete(&iface->config_ip.addr, &addr->node);
 	}
+
+	list_del(&a->head);
+	free(a);
 }
 
 static void
-write_resolv_conf_entries(FILE *f, struct interface_ip_settings *ip)
+interface_prefix_assign(struct device_prefix *prefix, struct interface *iface)
+{
+	struct device_prefix_assignment *a;
+	unsigned int length = iface->assignment_length;
+	union if_addr subnet;
+	uint32_t i, n, id, mask;
+
+	if (prefix->iface == iface || !length ||
+	    length < prefix->length || length > 64 ||
+	    length - prefix->length > 32)
+		return;
+
+	a = interface_prefix_find_assignment(prefix, iface->name);
+	if (a)
+		goto install;
+
+	mask = (length - prefix->length == 32) ? ~0U :
+		(1U << (length - prefix->length)) - 1;
+	n = (mask > 0xffff) ? 0x10000 : mask + 1;
+	id = (iface->assignment_hint >= 0) ? iface->assignment_hint & mask : 0;
+
+	for (i = 0; i < n; i++, id = (id + 1) & mask) {
+		interface_prefix_subnet(prefix, length, id, &subnet);
+		if (!interface_prefix_in_use(prefix, &subnet, length))
+			break;
+	}
+
+	if (i == n) {
+		D(INTERFACE, "No free subnet left in delegated prefix for interface '%s'\n",
+		  iface->name);
+		return;
+	}
+
+	a = calloc(1, sizeof(*a) + strlen(iface->name) + 1);
+	if (!a)
+		return;
+
+	a->assigned = id;
+	a->length = length;
+	memcpy(&a->subnet, &subnet, sizeof(subnet));
+	strcpy(a->name, iface->name);
+	list_add_tail(&a->head, &prefix->assignments);
+
+install:
+	if (iface->state == IFS_UP)
+		interface_prefix_install(iface, a);
+}
+
+static void
+interface_prefix_assign_all(struct device_prefix *prefix)
+{
+	struct interface *iface;
+
+	vlist_for_each_element(&interfaces, iface, node) {
+		if (iface->state == IFS_UP)
+			interface_prefix_assign(prefix, iface);
+	}
+}
+
+void
+interface_refresh_assignments(struct interface *iface)
+{
+	struct device_prefix_assignment *a;
+	struct device_prefix *prefix;
+
+	list_for_each_entry(prefix, &prefixes, head) {
+		a = interface_prefix_find_assignment(prefix, iface->name);
+		if (a)
+			interface_prefix_unassign(prefix, a);
+
+		if (iface->state == IFS_UP)
+			interface_prefix_assign(prefix, iface);
+	}
+}
+
+static void
+interface_prefix_iface_cb(struct interface_user *dep, struct interface *iface,
+			  enum interface_event ev)
+{
+	struct device_prefix_assignment *a;
+	struct device_prefix *prefix;
+
+	list_for_each_entry(prefix, &prefixes, head) {
+		switch (ev) {
+		case IFEV_UP:
+			/* keeps an existing assignment */
+			interface_prefix_assign(prefix, iface);
+			break;
+		case IFEV_FREE:
+			a = interface_prefix_find_assignment(prefix, iface->name);
+			if (a)
+				interface_prefix_unassign(prefix, a);
+			break;
+		default:
+			break;
+		}
+	}
+}
+
+void
+interface_ip_add_device_prefix(struct interface *iface, struct in6_addr *addr,
+			       unsigned int length)
+{
+	struct device_prefix *prefix;
+
+	if (length > 64)
+		return;
+
+	prefix = calloc(1, sizeof(*prefix));
+	if (!prefix)
+		return;
+
+	prefix->length = length;
+	memcpy(&prefix->addr, addr, sizeof(prefix->addr));
+	clear_if_addr((union if_addr *) &prefix->addr, length);
+	vlist_add(&iface->proto_ip.prefix, &prefix->node, &prefix->length);
+}
+
+/*
+ * Traffic to parts of the prefix that are not assigned must not follow
+ * the default route back to the upstream, which would route it back here.
+ */
+static void
+interface_prefix_set_route(struct device_prefix *prefix, bool add)
+{
+	struct device_route route;
+
+	memset(&route, 0, sizeof(route));
+	route.flags = DEVADDR_INET6 | DEVROUTE_UNREACHABLE;
+	route.mask = prefix->length;
+	route.metric = INT32_MAX;
+	route.table = interface_ip_table(prefix->iface, true);
+	memcpy(&route.addr.in6, &prefix->addr, sizeof(route.addr.in6));
+
+	if (add)
+		system_add_route(NULL, &route);
+	else
+		system_del_route(NULL, &route);
+}
+
+static void
+interface_update_prefix(struct vlist_tree *tree,
+			struct vlist_node *node_new,
+			struct vlist_node *node_old)
+{
+	struct interface_ip_settings *ip;
+	struct device_prefix *prefix_old, *prefix_new;
+	struct device_prefix_assignment *a, *tmp;
+
+	ip = container_of(tree, struct interface_ip_settings, prefix);
+	prefix_old = container_of(node_old, struct device_prefix, node);
+	prefix_new = container_of(node_new, struct device_prefix, node);
+
+	/* a renewal of the same prefix keeps all assignments */
+	if (node_old && node_new) {
+		free(prefix_new);
+		return;
+	}
+
+	if (node_old) {
+		system_batch_start();
+		list_for_each_entry_safe(a, tmp, &prefix_old->assignments, head)
+			interface_prefix_unassign(prefix_old, a);
+		interface_prefix_set_route(prefix_old, false);
+		system_batch_end();
+
+		list_del(&prefix_old->head);
+		free(prefix_old);
+	}
+
+	if (node_new) {
+		prefix_new->iface = ip->iface;
+		INIT_LIST_HEAD(&prefix_new->assignments);
+		list_add_tail(&prefix_new->head, &prefixes);
+
+		system_batch_start();
+		interface_prefix_set_route(prefix_new, true);
+		interface_prefix_assign_all(prefix_new);
+		system_batch_end();
+	}
+}
+
+/*
+ * A multipath route is installed as a single kernel route. Its nexthops
+ * follow the state of their interfaces: when a member goes up or down,
+ * only the routes using it are replaced with the new set of live nexthops.
+ */
+static int
+mp_route_resolve(struct device_mp_route *route)
+{
+	struct route_nexthop *nh;
+	struct interface *iface;
+	int i, n_active = 0;
+
+	for (i = 0; i < route->n_nexthops; i++) {
+		nh = &route->nexthops[i];
+		nh->dev = NULL;
+
+		if (!nh->active)
+			continue;
+
+		iface = vlist_find(&interfaces, nh->name, iface, node);
+		if (!iface || !iface->l3_dev.dev)
+			continue;
+
+		nh->dev = iface->l3_dev.dev;
+		n_active++;
+	}
+
+	return n_active;
+}
+
+static void
+mp_route_apply(struct device_mp_route *route, int n_active)
+{
+	if (n_active) {
+		/* replaces the previous set of nexthops in one request */
+		system_add_mp_route(route);
+		route->installed = true;
+	} else if (route->installed) {
+		system_del_mp_route(route);
+		route->installed = false;
+	}
+}
+
+static void
+mp_route_iface_cb(struct interface_user *dep, struct interface *iface,
+		  enum interface_event ev)
+{
+	struct device_mp_route *route;
+	struct route_nexthop *nh;
+	bool active, changed, update = false;
+	int i;
+
+	switch (ev) {
+	case IFEV_UPDATE:
+		/* the l3 device of a member that is up has changed */
+		update = true;
+		/* fall through */
+	case IFEV_UP:
+		active = true;
+		break;
+	case IFEV_DOWN:
+	case IFEV_FREE:
+		active = false;
+		break;
+	default:
+		return;
+	}
+
+	system_batch_start();
+	vlist_for_each_element(&mp_routes, route, node) {
+		changed = false;
+
+		for (i = 0; i < route->n_nexthops; i++) {
+			nh = &route->nexthops[i];
+			if (strcmp(nh->name, iface->name) != 0)
+				continue;
+
+			if (update) {
+				if (nh->active && nh->dev != iface->l3_dev.dev)
+					changed = true;
+				continue;
+			}
+
+			if (nh->active == active)
+				continue;
+
+			nh->active = active;
+			changed = true;
+		}
+
+		if (changed)
+			mp_route_apply(route, mp_route_resolve(route));
+	}
+	system_batch_end();
+}
+
+static bool
+mp_route_same_nexthops(struct device_mp_route *r1, struct device_mp_route *r2)
+{
+	struct route_nexthop *nh1, *nh2;
+	int i;
+
+	if (r1->n_nexthops != r2->n_nexthops)
+		return false;
+
+	for (i = 0; i < r1->n_nexthops; i++) {
+		nh1 = &r1->nexthops[i];
+		nh2 = &r2->nexthops[i];
+
+		if (strcmp(nh1->name, nh2->name) != 0 ||
+		    memcmp(&nh1->gw, &nh2->gw, sizeof(nh1->gw)) != 0 ||
+		    nh1->weight != nh2->weight ||
+		    nh1->active != nh2->active ||
+		    nh1->dev != nh2->dev)
+			return false;
+	}
+
+	return true;
+}
+
+static void
+interface_update_mp_route(struct vlist_tree *tree,
+			  struct vlist_node *node_new,
+			  struct vlist_node *node_old)
+{
+	struct device_mp_route *route_old, *route_new;
+	struct interface *iface;
+	bool same = false;
+	int i, n_active;
+
+	route_old = container_of(node_old, struct device_mp_route, node);
+	route_new = container_of(node_new, struct device_mp_route, node);
+
+	if (!node_new) {
+		if (route_old->installed)
+			system_del_mp_route(route_old);
+		free(route_old);
+		return;
+	}
+
+	for (i = 0; i < route_new->n_nexthops; i++) {
+		iface = vlist_find(&interfaces, route_new->nexthops[i].name, iface, node);
+		route_new->nexthops[i].active = iface && iface->state == IFS_UP;
+	}
+
+	n_active = mp_route_resolve(route_new);
+
+	if (node_old) {
+		route_new->installed = route_old->installed;
+
+		/* same key, the kernel route is updated in place if needed */
+		same = mp_route_same_nexthops(route_old, route_new);
+
+		free(route_old);
+	}
+
+	if (!same)
+		mp_route_apply(route_new, n_active);
+}
+
+void
+interface_add_dns_server(struct interface_ip_settings *ip, const char *str)
+{
+	struct dns_server *s;
+
+	s = calloc(1, sizeof(*s));
+	s->af = AF_INET;
+	if (inet_pton(s->af, str, &s->addr.in))
+		goto add;
+
+	s->af = AF_INET6;
+	if (inet_pton(s->af, str, &s->addr.in))
+		goto add;
+
+	free(s);
+	return;
+
+add:
+	D(INTERFACE, "Add IPv%c DNS server: %s\n",
+	  s->af == AF_INET6 ? '6' : '4', str);
+	vlist_simple_add(&ip->dns_servers, &s->node);
+}
+
+void
+interface_add_dns_server_list(struct interface_ip_settings *ip, struct blob_attr *list)
+{
+	struct blob_attr *cur;
+	int rem;
+
+	blobmsg_for_each_attr(cur, list, rem) {
+		if (blobmsg_type(cur) != BLOBMSG_TYPE_STRING)
+			continue;
+
+		if (!blobmsg_check_attr(cur, NULL))
+			continue;
+
+		interface_add_dns_server(ip, blobmsg_data(cur));
+	}
+}
+
+static void
+interface_add_dns_search_domain(struct interface_ip_settings *ip, const char *str)
+{
+	struct dns_search_domain *s;
+	int len = strlen(str);
+
+	s = calloc(1, sizeof(*s) + len + 1);
+	if (!s)
+		return;
+
+	D(INTERFACE, "Add DNS search domain: %s\n", str);
+	memcpy(s->name, str, len);
+	vlist_simple_add(&ip->dns_search, &s->node);
+}
+
+void
+interface_add_dns_search_list(struct interface_ip_settings *ip, struct blob_attr *list)
+{
+	struct blob_attr *cur;
+	int rem;
+
+	blobmsg_for_each_attr(cur, list, rem) {
+		if (blobmsg_type(cur) != BLOBMSG_TYPE_STRING)
+			continue;
+
+		if (!blobmsg_check_attr(cur, NULL))
+			continue;
+
+		interface_add_dns_search_domain(ip, blobmsg_data(cur));
+	}
+}
+
+static void
+write_resolv_conf_entries(FILE *f, struct interface_ip_settings *ip)
 {
 	struct dns_server *s;
 	struct dns_search_domain *d;
@@ -504,20 +1300,28 @@ write_resolv_conf_entries(FILE *f, struct interface_ip_settings *ip)
 	}
 }
 
-void
-interface_write_resolv_conf(void)
+/*
+ * resolv.conf updates are coalesced through a timer. The file is rendered
+ * into memory first and only replaced if the content has actually changed.
+ */
+#define RESOLV_CONF_DELAY	100
+
+static struct uloop_timeout resolv_conf_timer;
+static char *resolv_conf_data;
+static size_t resolv_conf_len;
+
+static void
+interface_do_write_resolv_conf(struct uloop_timeout *timeout)
 {
 	struct interface *iface;
 	char *path = alloca(strlen(resolv_conf) + 5);
+	char *data = NULL;
+	size_t len = 0;
 	FILE *f;
 
-	sprintf(path, "%s.tmp", resolv_conf);
-	unlink(path);
-	f = fopen(path, "w");
-	if (!f) {
-		D(INTERFACE, "Failed to open %s for writing\n", path);
+	f = open_memstream(&data, &len);
+	if (!f)
 		return;
-	}
 
 	vlist_for_each_element(&interfaces, iface, node) {
 		if (iface->state != IFS_UP)
@@ -535,10 +1339,44 @@ interface_write_resolv_conf(void)
 			write_resolv_conf_entries(f, &iface->proto_ip);
 	}
 	fclose(f);
-	if (rename(path, resolv_conf) < 0) {
+
+	if (resolv_conf_data && len == resolv_conf_len &&
+	    !memcmp(data, resolv_conf_data, len)) {
+		free(data);
+		return;
+	}
+
+	sprintf(path, "%s.tmp", resolv_conf);
+	unlink(path);
+	f = fopen(path, "w");
+	if (!f) {
+		D(INTERFACE, "Failed to open %s for writing\n", path);
+		free(data);
+		return;
+	}
+
+	fwrite(data, 1, len, f);
+	if (fclose(f) != 0 || rename(path, resolv_conf) < 0) {
 		D(INTERFACE, "Failed to replace %s\n", resolv_conf);
 		unlink(path);
+		free(data);
+		return;
 	}
+
+	netifd_stats.resolv_conf_writes++;
+	free(resolv_conf_data);
+	resolv_conf_data = data;
+	resolv_conf_len = len;
+}
+
+void
+interface_write_resolv_conf(void)
+{
+	if (resolv_conf_timer.pending)
+		return;
+
+	resolv_conf_timer.cb = interface_do_write_resolv_conf;
+	uloop_timeout_set(&resolv_conf_timer, RESOLV_CONF_DELAY);
 }
 
 void interface_ip_set_enabled(struct interface_ip_settings *ip, bool enabled)
@@ -552,12 +1390,13 @@ void interface_ip_set_enabled(struct interface_ip_settings *ip, bool enabled)
 	if (!dev)
 		return;
 
+	system_batch_start();
 	vlist_for_each_element(&ip->addr, addr, node) {
 		if (addr->enabled == enabled)
 			continue;
 
 		if (enabled)
-			system_add_address(dev, addr);
+			interface_add_address(ip->iface, dev, addr);
 		else
 			system_del_address(dev, addr);
 		addr->enabled = enabled;
@@ -581,17 +1420,411 @@ void interface_ip_set_enabled(struct interface_ip_settings *ip, bool enabled)
 			system_del_route(dev, route);
 		route->enabled = _enabled;
 	}
+	system_batch_end();
+}
+
+/*
+ * Repair of addresses and routes that were removed from the kernel by
+ * someone else. The kernel reports the removal, the entry is restored if
+ * it is still part of the active configuration. Restores leave existing
+ * entries alone and only count as repairs if the kernel did not have the
+ * entry anymore.
+ */
+static void
+interface_ip_restore_address(struct interface *iface, struct device *dev,
+			     struct device_addr *addr)
+{
+	struct device_route route;
+
+	interface_subnet_route_init(&route, iface, addr);
+
+	if (iface->metric && !route.table &&
+	    !system_restore_address(dev, addr, true)) {
+		route.metric = iface->metric;
+		system_restore_route(dev, &route);
+		return;
+	}
+
+	system_restore_address(dev, addr, false);
+	if (iface->metric || route.table)
+		interface_handle_subnet_route(iface, addr, true);
+}
+
+static void
+interface_ip_repair_routes(struct vlist_tree *tree, struct device *dev,
+			   enum device_addr_flags family, bool host)
+{
+	struct device_route *route;
+
+	vlist_for_each_element(tree, route, node) {
+		if ((route->flags & DEVADDR_FAMILY) != family)
+			continue;
+
+		if (!host && (!route->enabled || (route->flags & DEVADDR_EXTERNAL)))
+			continue;
+
+		system_restore_route(dev, route);
+	}
+}
+
+static bool
+interface_ip_repair_addr_list(struct interface_ip_settings *ip, struct device *dev,
+			      struct device_addr *key)
+{
+	struct device_addr *addr;
+
+	if (!ip->enabled)
+		return false;
+
+	addr = vlist_find(&ip->addr, &key->flags, addr, node);
+	if (!addr || !addr->enabled || addr->reprogrammed)
+		return false;
+
+	D(INTERFACE, "Restoring address on interface '%s'\n", ip->iface->name);
+	interface_ip_restore_address(ip->iface, dev, addr);
+	return true;
+}
+
+void
+interface_ip_repair_addr(int ifindex, struct device_addr *addr)
+{
+	enum device_addr_flags family = addr->flags & DEVADDR_FAMILY;
+	struct interface *iface;
+	struct device *dev;
+	bool found;
+
+	vlist_for_each_element(&interfaces, iface, node) {
+		dev = iface->l3_dev.dev;
+		if (!dev || dev->ifindex != ifindex)
+			continue;
+
+		found = interface_ip_repair_addr_list(&iface->proto_ip, dev, addr);
+		found |= interface_ip_repair_addr_list(&iface->config_ip, dev, addr);
+		if (!found)
+			continue;
+
+		/*
+		 * The kernel drops the routes using the address without
+		 * notification, those of the same family are put back
+		 */
+		interface_ip_repair_routes(&iface->proto_ip.route, dev, family, false);
+		interface_ip_repair_routes(&iface->config_ip.route, dev, family, false);
+		interface_ip_repair_routes(&iface->host_routes, dev, family, true);
+	}
+}
+
+/* the address is back after netifd deleted and added it again */
+void
+interface_ip_repair_addr_added(int ifindex, struct device_addr *key)
+{
+	struct interface_ip_settings *ip[2];
+	struct interface *iface;
+	struct device_addr *addr;
+	struct device *dev;
+	int i;
+
+	vlist_for_each_element(&interfaces, iface, node) {
+		dev = iface->l3_dev.dev;
+		if (!dev || dev->ifindex != ifindex)
+			continue;
+
+		ip[0] = &iface->proto_ip;
+		ip[1] = &iface->config_ip;
+		for (i = 0; i < ARRAY_SIZE(ip); i++) {
+			addr = vlist_find(&ip[i]->addr, &key->flags, addr, node);
+			if (addr)
+				addr->reprogrammed = false;
+		}
+	}
+}
+
+static struct device_route *
+interface_ip_find_route(struct vlist_tree *tree, struct device_route *key)
+{
+	struct device_route *route;
+	bool v6 = (key->flags & DEVADDR_FAMILY) == DEVADDR_INET6;
+	int metric = key->metric;
+
+	/* the metric flag is part of the key, the kernel does not know it */
+	route = vlist_find(tree, &key->table, route, node);
+	if (!route) {
+		key->flags |= DEVROUTE_METRIC;
+		route = vlist_find(tree, &key->table, route, node);
+		key->flags &= ~DEVROUTE_METRIC;
+	}
+
+	if (!route || (route->flags & DEVADDR_EXTERNAL))
+		return NULL;
+
+	if (memcmp(&route->nexthop, &key->nexthop, sizeof(route->nexthop)) != 0)
+		return NULL;
+
+	/* IPv6 routes without metric get the kernel default */
+	if (v6 && !route->metric && metric == 1024)
+		metric = 0;
+
+	if (route->metric != metric)
+		return NULL;
+
+	return route;
+}
+
+void
+interface_ip_repair_route(int ifindex, struct device_route *key)
+{
+	struct interface_ip_settings *ip[2];
+	struct interface *iface;
+	struct device_route *route;
+	struct device *dev;
+	int i;
+
+	vlist_for_each_element(&interfaces, iface, node) {
+		dev = iface->l3_dev.dev;
+		if (!dev || dev->ifindex != ifindex)
+			continue;
+
+		ip[0] = &iface->proto_ip;
+		ip[1] = &iface->config_ip;
+		for (i = 0; i < ARRAY_SIZE(ip); i++) {
+			route = interface_ip_find_route(&ip[i]->route, key);
+			if (!route || !route->enabled)
+				continue;
+
+			D(INTERFACE, "Restoring route on interface '%s'\n", iface->name);
+			system_restore_route(dev, route);
+		}
+
+		route = interface_ip_find_route(&iface->host_routes, key);
+		if (route)
+			system_restore_route(dev, route);
+	}
+}
+
+/*
+ * Resync after event messages were lost: the kernel addresses and routes
+ * are dumped, everything that is enabled but was not in the dump is added
+ * again.
+ */
+void
+interface_ip_resync_start(void)
+{
+	struct interface_ip_settings *ip[2];
+	struct interface *iface;
+	struct device_addr *addr;
+	struct device_route *route;
+	int i;
+
+	vlist_for_each_element(&interfaces, iface, node) {
+		ip[0] = &iface->proto_ip;
+		ip[1] = &iface->config_ip;
+		for (i = 0; i < ARRAY_SIZE(ip); i++) {
+			vlist_for_each_element(&ip[i]->addr, addr, node) {
+				addr->present = false;
+				addr->reprogrammed = false;
+			}
+			vlist_for_each_element(&ip[i]->route, route, node)
+				route->present = false;
+		}
+
+		vlist_for_each_element(&iface->host_routes, route, node)
+			route->present = false;
+	}
+}
+
+void
+interface_ip_resync_addr(int ifindex, struct device_addr *key)
+{
+	struct interface_ip_settings *ip[2];
+	struct interface *iface;
+	struct device_addr *addr;
+	struct device *dev;
+	int i;
+
+	vlist_for_each_element(&interfaces, iface, node) {
+		dev = iface->l3_dev.dev;
+		if (!dev || dev->ifindex != ifindex)
+			continue;
+
+		ip[0] = &iface->proto_ip;
+		ip[1] = &iface->config_ip;
+		for (i = 0; i < ARRAY_SIZE(ip); i++) {
+			addr = vlist_find(&ip[i]->addr, &key->flags, addr, node);
+			if (addr)
+				addr->present = true;
+		}
+	}
+}
+
+void
+interface_ip_resync_route(int ifindex, struct device_route *key)
+{
+	struct interface_ip_settings *ip[2];
+	struct interface *iface;
+	struct device_route *route;
+	struct device *dev;
+	int i;
+
+	vlist_for_each_element(&interfaces, iface, node) {
+		dev = iface->l3_dev.dev;
+		if (!dev || dev->ifindex != ifindex)
+			continue;
+
+		ip[0] = &iface->proto_ip;
+		ip[1] = &iface->config_ip;
+		for (i = 0; i < ARRAY_SIZE(ip); i++) {
+			route = interface_ip_find_route(&ip[i]->route, key);
+			if (route)
+				route->present = true;
+		}
+
+		route = interface_ip_find_route(&iface->host_routes, key);
+		if (route)
+			route->present = true;
+	}
+}
+
+static void
+interface_ip_resync_list(struct interface_ip_settings *ip, struct device *dev)
+{
+	struct device_addr *addr;
+	struct device_route *route;
+
+	if (!ip->enabled)
+		return;
+
+	vlist_for_each_element(&ip->addr, addr, node) {
+		if (addr->present || !addr->enabled || (addr->flags & DEVADDR_EXTERNAL))
+			continue;
+
+		D(INTERFACE, "Restoring address on interface '%s'\n", ip->iface->name);
+		interface_ip_restore_address(ip->iface, dev, addr);
+	}
+
+	/* after the addresses, routes may depend on them */
+	vlist_for_each_element(&ip->route, route, node) {
+		if (route->present || !route->enabled || (route->flags & DEVADDR_EXTERNAL))
+			continue;
+
+		system_restore_route(dev, route);
+	}
+}
+
+void
+interface_ip_resync_complete(void)
+{
+	struct interface *iface;
+	struct device_route *route;
+	struct device *dev;
+
+	vlist_for_each_element(&interfaces, iface, node) {
+		dev = iface->l3_dev.dev;
+		if (!dev || iface->state != IFS_UP)
+			continue;
+
+		interface_ip_resync_list(&iface->proto_ip, dev);
+		interface_ip_resync_list(&iface->config_ip, dev);
+
+		vlist_for_each_element(&iface->host_routes, route, node) {
+			if (!route->present)
+				system_restore_route(dev, route);
+		}
+	}
+}
+
+/*
+ * Move the routes of an interface to a new metric. The metric is part of
+ * the kernel route key, so the route with the new metric is added before
+ * the old one is removed. A delete without metric matches any metric
+ * though, so routes that had none are removed first. Addresses are not
+ * touched.
+ */
+static void
+interface_ip_swap_route(struct device *dev, struct device_route *route, int metric)
+{
+	struct device_route old;
+
+	memcpy(&old, route, sizeof(old));
+	route->flags &= ~DEVADDR_KERNEL;
+	route->metric = metric;
+
+	if (!old.metric)
+		system_del_route(dev, &old);
+
+	system_add_route(dev, route);
+
+	if (old.metric)
+		system_del_route(dev, &old);
+}
+
+void interface_ip_update_metric(struct interface_ip_settings *ip, int metric)
+{
+	struct interface *iface = ip->iface;
+	struct device_route *route, subnet;
+	struct device_addr *addr;
+	struct device *dev;
+
+	dev = iface->l3_dev.dev;
+	if (!dev || !ip->enabled || iface->metric == metric)
+		return;
+
+	system_batch_start();
+
+	vlist_for_each_element(&ip->addr, addr, node) {
+		if (!addr->enabled || (addr->flags & DEVADDR_EXTERNAL))
+			continue;
+
+		interface_subnet_route_init(&subnet, iface, addr);
+		subnet.metric = iface->metric;
+
+		/* without a metric, the subnet route is the one added by the kernel */
+		if (!subnet.metric && !subnet.table)
+			subnet.flags |= DEVADDR_KERNEL;
+
+		interface_ip_swap_route(dev, &subnet, metric);
+	}
+
+	vlist_for_each_element(&ip->route, route, node) {
+		if (!route->enabled || (route->flags & DEVROUTE_METRIC))
+			continue;
+
+		interface_ip_swap_route(dev, route, metric);
+	}
+
+	system_batch_end();
+}
+
+void
+interface_ip_mp_update_start(void)
+{
+	vlist_update(&mp_routes);
+}
+
+void
+interface_ip_mp_update_complete(void)
+{
+	system_batch_start();
+	vlist_flush(&mp_routes);
+	system_batch_end();
+}
+
+static int
+mp_route_cmp(const void *k1, const void *k2, void *ptr)
+{
+	return memcmp(k1, k2, offsetof(struct device_mp_route, n_nexthops) -
+		      offsetof(struct device_mp_route, table));
 }
 
 void
 interface_ip_update_start(struct interface_ip_settings *ip)
 {
+	ip->hash = 0;
 	if (ip != &ip->iface->config_ip) {
 		vlist_simple_update(&ip->dns_servers);
 		vlist_simple_update(&ip->dns_search);
 	}
 	vlist_update(&ip->route);
 	vlist_update(&ip->addr);
+	vlist_update(&ip->prefix);
 }
 
 void
@@ -599,19 +1832,24 @@ interface_ip_update_complete(struct interface_ip_settings *ip)
 {
 	vlist_simple_flush(&ip->dns_servers);
 	vlist_simple_flush(&ip->dns_search);
+	system_batch_start();
 	vlist_flush(&ip->route);
 	vlist_flush(&ip->addr);
+	vlist_flush(&ip->prefix);
+	system_batch_end();
 }
 
 void
 interface_ip_flush(struct interface_ip_settings *ip)
 {
+	ip->hash = 0;
 	if (ip == &ip->iface->proto_ip)
 		vlist_flush_all(&ip->iface->host_routes);
 	vlist_simple_flush_all(&ip->dns_servers);
 	vlist_simple_flush_all(&ip->dns_search);
 	vlist_flush_all(&ip->route);
 	vlist_flush_all(&ip->addr);
+	vlist_flush_all(&ip->prefix);
 }
 
 static void
@@ -623,6 +1861,8 @@ __interface_ip_init(struct interface_ip_settings *ip, struct interface *iface)
 	vlist_simple_init(&ip->dns_servers, struct dns_server, node);
 	vlist_init(&ip->route, route_cmp, interface_update_proto_route);
 	vlist_init(&ip->addr, addr_cmp, interface_update_proto_addr);
+	vlist_init(&ip->prefix, prefix_cmp, interface_update_prefix);
+	ip->prefix.keep_old = true;
 }
 
 void
@@ -632,3 +1872,13 @@ interface_ip_init(struct interface *iface)
 	__interface_ip_init(&iface->config_ip, iface);
 	vlist_init(&iface->host_routes, route_cmp, interface_update_host_route);
 }
+
+static void __init
+interface_ip_mp_init(void)
+{
+	vlist_init(&mp_routes, mp_route_cmp, interface_update_mp_route);
+	mp_route_user.cb = mp_route_iface_cb;
+	interface_add_user(&mp_route_user, NULL);
+	prefix_user.cb = interface_prefix_iface_cb;
+	interface_add_user(&prefix_user, NULL);
+}
@@ -30,6 +30,9 @@ enum device_addr_flags {
 
 	/* route automatically added by kernel */
 	DEVADDR_KERNEL		= (1 << 4),
+
+	/* unreachable route, not bound to a device */
+	DEVROUTE_UNREACHABLE	= (1 << 5),
 };
 
 union if_addr {
@@ -41,6 +44,12 @@ struct device_addr {
 	struct vlist_node node;
 	bool enabled;
 
+	/* found in the kernel during a resync */
+	bool present;
+
+	/* deleted and added again by netifd, its RTM_DELADDR is no repair */
+	bool reprogrammed;
+
 	/* ipv4 only */
 	uint32_t broadcast;
 	uint32_t point_to_point;
@@ -58,14 +67,65 @@ struct device_route {
 	bool enabled;
 	bool keep;
 
+	/* found in the kernel during a resync */
+	bool present;
+
 	union if_addr nexthop;
 	int metric;
 	int mtu;
 
 	/* must be last */
+	unsigned int table;
+	enum device_addr_flags flags;
+	unsigned int mask;
+	union if_addr addr;
+};
+
+struct device_prefix {
+	struct vlist_node node;
+	struct list_head head;
+	struct list_head assignments;
+	struct interface *iface;
+
+	/* must be last */
+	unsigned int length;
+	struct in6_addr addr;
+};
+
+struct device_prefix_assignment {
+	struct list_head head;
+	uint32_t assigned;
+	unsigned int length;
+	union if_addr subnet;
+	char name[];
+};
+
+struct route_nexthop {
+	/* logical interface name, stored after the nexthops of the route */
+	const char *name;
+	union if_addr gw;
+	unsigned int weight;
+
+	/* member interface is up */
+	bool active;
+
+	/* device used for the current kernel route, NULL if left out */
+	struct device *dev;
+};
+
+struct device_mp_route {
+	struct vlist_node node;
+	bool installed;
+
+	/* used as vlist key */
+	unsigned int table;
 	enum device_addr_flags flags;
+	int metric;
 	unsigned int mask;
 	union if_addr addr;
+
+	int n_nexthops;
+	struct route_nexthop nexthops[];
 };
 
 struct dns_server {
@@ -88,6 +148,15 @@ void interface_add_dns_search_list(struct interface_ip_settings *ip, struct blob
 void interface_write_resolv_conf(void);
 
 void interface_ip_add_route(struct interface *iface, struct blob_attr *attr, bool v6);
+void interface_ip_add_route_set(struct interface *iface, struct blob_attr *attr, bool v6);
+
+struct device_addr *interface_ip_alloc_addr(bool v6);
+void interface_ip_free_addr(struct device_addr *addr);
+struct device_route *interface_ip_alloc_route(bool v6);
+void interface_ip_free_route(struct device_route *route);
+
+void interface_ip_mp_update_start(void);
+void interface_ip_mp_update_complete(void);
 
 void interface_ip_update_start(struct interface_ip_settings *ip);
 void interface_ip_update_complete(struct interface_ip_settings *ip);
@@ -95,6 +164,22 @@ void interface_ip_flush(struct interface_ip_settings *ip);
 void interface_ip_set_enabled(struct interface_ip_settings *ip, bool enabled);
 void interface_ip_update_metric(struct interface_ip_settings *ip, int metric);
 
+void interface_ip_add_device_prefix(struct interface *iface, struct in6_addr *addr,
+				    unsigned int length);
+void interface_refresh_assignments(struct interface *iface);
+
+extern struct list_head prefixes;
+
+void interface_ip_repair_addr(int ifindex, struct device_addr *addr);
+void interface_ip_repair_addr_added(int ifindex, struct device_addr *addr);
+void interface_ip_repair_route(int ifindex, struct device_route *route);
+
+void interface_ip_resync_start(void);
+void interface_ip_resync_addr(int ifindex, struct device_addr *addr);
+void interface_ip_resync_route(int ifindex, struct device_route *route);
+void interface_ip_resync_complete(void);
+
 struct interface *interface_ip_add_target_route(union if_addr *addr, bool v6);
+unsigned int interface_ip_table(struct interface *iface, bool v6);
 
 #endif
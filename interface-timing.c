@@ -0,0 +1,235 @@
+/*
+ * netifd - network interface daemon
+ * Copyright (C) 2012 Felix Fietkau <nbd@openwrt.org>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2
+ * as published by the Free Software Foundation
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ */
+#include <string.h>
+#include <stdlib.h>
+#include <stdio.h>
+
+#include "netifd.h"
+#include "interface.h"
+#include "proto.h"
+#include "system.h"
+
+/*
+ * Bring-up latency tracking.
+ *
+ * Every interface records a timestamp when it passes one of the marks below
+ * during a bring-up cycle. The time spent between a mark and the previous
+ * one recorded in the same cycle is added to a histogram of the interface
+ * and to one of its protocol handler.
+ */
+
+static const char * const timing_mark_names[__IFT_MAX] = {
+	[IFT_DEV_PRESENT] = "device_present",
+	[IFT_SET_UP] = "set_up",
+	[IFT_DEV_CLAIM] = "device_claim",
+	[IFT_PROTO_SETUP] = "proto_setup",
+	[IFT_PROTO_UPDATE] = "proto_update",
+	[IFT_PROTO_UP] = "proto_up",
+	[IFT_HOTPLUG_DONE] = "hotplug_done",
+};
+
+struct proto_timing {
+	struct avl_node avl;
+	struct interface_timing_stats stats;
+	char name[];
+};
+
+static struct avl_tree proto_timing;
+
+static void
+timing_hist_add(struct interface_timing_hist *h, unsigned int msec)
+{
+	int bucket = fls(msec);
+
+	if (bucket >= IFT_HIST_BUCKETS)
+		bucket = IFT_HIST_BUCKETS - 1;
+
+	h->buckets[bucket]++;
+	h->count++;
+	if (msec > h->max)
+		h->max = msec;
+}
+
+static unsigned int
+timing_hist_percentile(struct interface_timing_hist *h, int pct)
+{
+	unsigned int limit = (h->count * pct + 99) / 100;
+	unsigned int sum = 0, val;
+	int i;
+
+	for (i = 0; i < IFT_HIST_BUCKETS - 1; i++) {
+		sum += h->buckets[i];
+		if (sum >= limit)
+			break;
+	}
+
+	/* upper bound of the bucket, never more than the recorded maximum */
+	val = i ? (1 << i) - 1 : 0;
+	if (i == IFT_HIST_BUCKETS - 1 || val > h->max)
+		val = h->max;
+
+	return val;
+}
+
+static void
+timing_stats_add(struct interface_timing_stats *s, int mark, unsigned int msec)
+{
+	if (mark < 0)
+		timing_hist_add(&s->total, msec);
+	else
+		timing_hist_add(&s->hist[mark], msec);
+}
+
+static struct interface_timing_stats *
+timing_proto_stats(struct interface *iface)
+{
+	struct proto_timing *pt;
+	const char *name;
+
+	if (!iface->proto_handler)
+		return NULL;
+
+	name = iface->proto_handler->name;
+	if (!proto_timing.comp)
+		avl_init(&proto_timing, avl_strcmp, false, NULL);
+
+	pt = avl_find_element(&proto_timing, name, pt, avl);
+	if (pt)
+		return &pt->stats;
+
+	pt = calloc(1, sizeof(*pt) + strlen(name) + 1);
+	if (!pt)
+		return NULL;
+
+	strcpy(pt->name, name);
+	pt->avl.key = pt->name;
+	avl_insert(&proto_timing, &pt->avl);
+	return &pt->stats;
+}
+
+void
+interface_timing_mark(struct interface *iface, enum interface_timing_mark mark)
+{
+	struct interface_timing *t = iface->timing;
+	struct interface_timing_stats *ps;
+	unsigned int delta;
+	uint64_t now;
+	int i, prev = -1;
+
+	if (!t) {
+		t = iface->timing = calloc(1, sizeof(*t));
+		if (!t)
+			return;
+	}
+
+	now = system_get_rtime_msec();
+
+	/*
+	 * a new cycle starts when the device shows up, or on a set_up
+	 * call that is not preceded by a device event
+	 */
+	if (mark == IFT_DEV_PRESENT || (mark == IFT_SET_UP && (t->marks & ~1)))
+		t->marks = 0;
+
+	/* only the first occurrence of a mark counts in each cycle */
+	if (t->marks & (1 << mark))
+		return;
+
+	for (i = mark - 1; i >= 0; i--) {
+		if (!(t->marks & (1 << i)))
+			continue;
+
+		prev = i;
+		break;
+	}
+
+	t->ts[mark] = now;
+	t->marks |= (1 << mark);
+	if (prev < 0)
+		return;
+
+	ps = timing_proto_stats(iface);
+
+	delta = now - t->ts[prev];
+	timing_stats_add(&t->stats, mark, delta);
+	if (ps)
+		timing_stats_add(ps, mark, delta);
+
+	if (mark != IFT_PROTO_UP)
+		return;
+
+	for (i = 0; !(t->marks & (1 << i)); i++);
+
+	delta = now - t->ts[i];
+	timing_stats_add(&t->stats, -1, delta);
+	if (ps)
+		timing_stats_add(ps, -1, delta);
+}
+
+void
+interface_timing_free(struct interface *iface)
+{
+	free(iface->timing);
+	iface->timing = NULL;
+}
+
+static void
+timing_hist_dump(struct blob_buf *b, const char *name, struct interface_timing_hist *h)
+{
+	void *c;
+
+	if (!h->count)
+		return;
+
+	c = blobmsg_open_table(b, name);
+	blobmsg_add_u32(b, "count", h->count);
+	blobmsg_add_u32(b, "p50", timing_hist_percentile(h, 50));
+	blobmsg_add_u32(b, "p99", timing_hist_percentile(h, 99));
+	blobmsg_add_u32(b, "max", h->max);
+	blobmsg_close_table(b, c);
+}
+
+static void
+timing_stats_dump(struct blob_buf *b, const char *name, struct interface_timing_stats *s)
+{
+	void *c;
+	int i;
+
+	c = blobmsg_open_table(b, name);
+	for (i = 0; i < __IFT_MAX; i++)
+		timing_hist_dump(b, timing_mark_names[i], &s->hist[i]);
+	timing_hist_dump(b, "total", &s->total);
+	blobmsg_close_table(b, c);
+}
+
+void
+interface_timing_dump(struct blob_buf *b, struct interface *iface)
+{
+	struct interface_timing_stats empty = {};
+	struct proto_timing *pt;
+	void *c;
+
+	if (iface) {
+		timing_stats_dump(b, iface->name,
+				  iface->timing ? &iface->timing->stats : &empty);
+		return;
+	}
+
+	c = blobmsg_open_table(b, "proto");
+	if (proto_timing.comp) {
+		avl_for_each_element(&proto_timing, pt, avl)
+			timing_stats_dump(b, pt->name, &pt->stats);
+	}
+	blobmsg_close_table(b, c);
+}
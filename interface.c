@@ -37,6 +37,10 @@ enum {
 	IFACE_ATTR_DNS_SEARCH,
 	IFACE_ATTR_METRIC,
 	IFACE_ATTR_INTERFACE,
+	IFACE_ATTR_IP4TABLE,
+	IFACE_ATTR_IP6TABLE,
+	IFACE_ATTR_IP6ASSIGN,
+	IFACE_ATTR_IP6HINT,
 	IFACE_ATTR_MAX
 };
 
@@ -50,6 +54,10 @@ static const struct blobmsg_policy iface_attrs[IFACE_ATTR_MAX] = {
 	[IFACE_ATTR_DNS] = { .name = "dns", .type = BLOBMSG_TYPE_ARRAY },
 	[IFACE_ATTR_DNS_SEARCH] = { .name = "dns_search", .type = BLOBMSG_TYPE_ARRAY },
 	[IFACE_ATTR_INTERFACE] = { .name = "interface", .type = BLOBMSG_TYPE_STRING },
+	[IFACE_ATTR_IP4TABLE] = { .name = "ip4table", .type = BLOBMSG_TYPE_STRING },
+	[IFACE_ATTR_IP6TABLE] = { .name = "ip6table", .type = BLOBMSG_TYPE_STRING },
+	[IFACE_ATTR_IP6ASSIGN] = { .name = "ip6assign", .type = BLOBMSG_TYPE_INT32 },
+	[IFACE_ATTR_IP6HINT] = { .name = "ip6hint", .type = BLOBMSG_TYPE_STRING },
 };
 
 static const union config_param_info iface_attr_info[IFACE_ATTR_MAX] = {
@@ -205,6 +213,7 @@ interface_cb(struct device_user *dep, enum device_event ev)
 	iface = container_of(dep, struct interface, main_dev);
 	switch (ev) {
 	case DEV_EVENT_ADD:
+		interface_timing_mark(iface, IFT_DEV_PRESENT);
 		new_state = true;
 		break;
 	case DEV_EVENT_REMOVE:
@@ -278,6 +287,7 @@ interface_alias_cb(struct interface_user *dep, struct interface *iface, enum int
 		interface_remove_user(dep);
 		break;
 	case IFEV_RELOAD:
+	case IFEV_UPDATE:
 		break;
 	}
 }
@@ -334,6 +344,7 @@ interface_do_free(struct interface *iface)
 	interface_event(iface, IFEV_FREE);
 	interface_cleanup(iface, false);
 	free(iface->config);
+	interface_timing_free(iface);
 	netifd_ubus_remove_interface(iface);
 	avl_delete(&interfaces.avl, &iface->node.avl);
 	free(iface);
@@ -382,6 +393,7 @@ interface_proto_cb(struct interface_proto_state *state, enum interface_proto_eve
 		system_flush_routes();
 		iface->state = IFS_UP;
 		iface->start_time = system_get_rtime();
+		interface_timing_mark(iface, IFT_PROTO_UP);
 		interface_event(iface, IFEV_UP);
 		interface_write_resolv_conf();
 		netifd_log_message(L_NOTICE, "Interface '%s' is now up\n", iface->name);
@@ -461,6 +473,33 @@ interface_init(struct interface *iface, const char *name,
 	if ((cur = tb[IFACE_ATTR_METRIC]))
 		iface->metric = blobmsg_get_u32(cur);
 
+	if ((cur = tb[IFACE_ATTR_IP4TABLE])) {
+		if (!system_resolve_rt_table(blobmsg_data(cur), &iface->ip4table))
+			DPRINTF("Failed to resolve routing table: %s\n", (char *) blobmsg_data(cur));
+	}
+
+	if ((cur = tb[IFACE_ATTR_IP6TABLE])) {
+		if (!system_resolve_rt_table(blobmsg_data(cur), &iface->ip6table))
+			DPRINTF("Failed to resolve routing table: %s\n", (char *) blobmsg_data(cur));
+	}
+
+	/* subnet size and preferred subnet id within delegated prefixes */
+	if ((cur = tb[IFACE_ATTR_IP6ASSIGN]))
+		iface->assignment_length = blobmsg_get_u32(cur);
+
+	iface->assignment_hint = -1;
+	if ((cur = tb[IFACE_ATTR_IP6HINT])) {
+		const char *str = blobmsg_get_string(cur);
+		unsigned long hint;
+		char *err;
+
+		hint = strtoul(str, &err, 16);
+		if (!*str || *err || hint > INT32_MAX)
+			DPRINTF("Invalid ip6hint: %s\n", str);
+		else
+			iface->assignment_hint = hint;
+	}
+
 	iface->config_autostart = iface->autostart;
 }
 
@@ -522,6 +561,9 @@ interface_set_l3_dev(struct interface *iface, struct device *dev)
 			device_claim(&iface->l3_dev);
 		interface_ip_set_enabled(&iface->config_ip, enabled);
 	}
+
+	if (iface->state == IFS_UP)
+		interface_event(iface, IFEV_UPDATE);
 }
 
 void
@@ -549,8 +591,8 @@ interface_remove_link(struct interface *iface, struct device *dev)
 {
 	struct device *mdev = iface->main_dev.dev;
 
-	if (mdev && mdev->hotplug_ops)
-		return mdev->hotplug_ops->del(mdev, dev);
+	if (mdev && mdev->type->hotplug_ops)
+		return mdev->type->hotplug_ops->del(mdev, dev);
 
 	if (!iface->main_dev.hotplug)
 		return UBUS_STATUS_INVALID_ARGUMENT;
@@ -574,8 +616,8 @@ interface_add_link(struct interface *iface, struct device *dev)
 		device_remove_user(&iface->main_dev);
 
 	if (mdev) {
-		if (mdev->hotplug_ops)
-			return mdev->hotplug_ops->add(mdev, dev);
+		if (mdev->type->hotplug_ops)
+			return mdev->type->hotplug_ops->add(mdev, dev);
 		else
 			return UBUS_STATUS_NOT_SUPPORTED;
 	}
@@ -601,13 +643,17 @@ interface_set_up(struct interface *iface)
 		return -1;
 	}
 
+	interface_timing_mark(iface, IFT_SET_UP);
 	if (iface->main_dev.dev) {
 		ret = device_claim(&iface->main_dev);
 		if (ret)
 			return ret;
+
+		interface_timing_mark(iface, IFT_DEV_CLAIM);
 	}
 
 	iface->state = IFS_SETUP;
+	interface_timing_mark(iface, IFT_PROTO_SETUP);
 	ret = interface_proto_event(iface->proto, PROTO_CMD_SETUP, false);
 	if (ret) {
 		mark_interface_down(iface);
@@ -700,6 +746,15 @@ interface_change_config(struct interface *if_old, struct interface *if_new)
 		goto reload;
 	}
 
+	if (if_old->ip4table != if_new->ip4table ||
+	    if_old->ip6table != if_new->ip6table) {
+		D(INTERFACE, "Reload interface '%s' because of routing table change\n",
+		  if_old->name);
+		if_old->ip4table = if_new->ip4table;
+		if_old->ip6table = if_new->ip6table;
+		goto reload;
+	}
+
 	if (FIELD_CHANGED_STR(ifname) || proto != if_new->proto_handler) {
 		D(INTERFACE, "Reload interface '%s' because of ifname/proto change\n",
 		  if_old->name);
@@ -722,13 +777,26 @@ interface_change_config(struct interface *if_old, struct interface *if_new)
 		__changed;						\
 	})
 
-	if (UPDATE(metric) || UPDATE(proto_ip.no_defaultroute)) {
+	if (if_old->metric != if_new->metric) {
+		interface_ip_update_metric(&if_old->config_ip, if_new->metric);
+		interface_ip_update_metric(&if_old->proto_ip, if_new->metric);
+		if_old->metric = if_new->metric;
+	}
+
+	if (UPDATE(proto_ip.no_defaultroute)) {
 		interface_ip_set_enabled(&if_old->config_ip, false);
 		interface_ip_set_enabled(&if_old->config_ip, if_new->config_ip.enabled);
 		interface_ip_set_enabled(&if_old->proto_ip, false);
 		interface_ip_set_enabled(&if_old->proto_ip, if_new->proto_ip.enabled);
 	}
 
+	if (if_old->assignment_length != if_new->assignment_length ||
+	    if_old->assignment_hint != if_new->assignment_hint) {
+		if_old->assignment_length = if_new->assignment_length;
+		if_old->assignment_hint = if_new->assignment_hint;
+		interface_refresh_assignments(if_old);
+	}
+
 	UPDATE(proto_ip.no_dns);
 	interface_replace_dns(&if_old->config_ip, &if_new->config_ip);
 	interface_write_resolv_conf();
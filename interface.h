@@ -25,6 +25,8 @@ enum interface_event {
 	IFEV_UP,
 	IFEV_FREE,
 	IFEV_RELOAD,
+	/* the l3 device of an interface that is up has changed */
+	IFEV_UPDATE,
 };
 
 enum interface_state {
@@ -60,13 +62,49 @@ struct interface_ip_settings {
 	bool no_defaultroute;
 	bool no_dns;
 
+	/* hash of the protocol data the settings were last built from */
+	uint64_t hash;
+
 	struct vlist_tree addr;
 	struct vlist_tree route;
+	struct vlist_tree prefix;
 
 	struct vlist_simple_tree dns_servers;
 	struct vlist_simple_tree dns_search;
 };
 
+enum interface_timing_mark {
+	IFT_DEV_PRESENT,
+	IFT_SET_UP,
+	IFT_DEV_CLAIM,
+	IFT_PROTO_SETUP,
+	IFT_PROTO_UPDATE,
+	IFT_PROTO_UP,
+	IFT_HOTPLUG_DONE,
+	__IFT_MAX
+};
+
+/* log2 histogram of latencies in msec, the last bucket catches the rest */
+#define IFT_HIST_BUCKETS	16
+
+struct interface_timing_hist {
+	unsigned int count;
+	unsigned int max;
+	unsigned int buckets[IFT_HIST_BUCKETS];
+};
+
+struct interface_timing_stats {
+	struct interface_timing_hist hist[__IFT_MAX];
+	struct interface_timing_hist total;
+};
+
+struct interface_timing {
+	uint64_t ts[__IFT_MAX];
+	unsigned int marks;
+
+	struct interface_timing_stats stats;
+};
+
 struct interface_data {
 	struct avl_node node;
 	struct blob_attr data[];
@@ -88,6 +126,8 @@ struct interface {
 	bool config_autostart;
 
 	time_t start_time;
+	time_t update_time;
+	struct interface_timing *timing;
 	enum interface_state state;
 	enum interface_config_state config_state;
 
@@ -113,6 +153,12 @@ struct interface {
 	struct vlist_tree host_routes;
 
 	int metric;
+	unsigned int ip4table;
+	unsigned int ip6table;
+
+	/* size of the subnets taken from delegated prefixes, 0 if disabled */
+	unsigned int assignment_length;
+	int assignment_hint;
 
 	/* errors/warnings while trying to bring up the interface */
 	struct list_head errors;
@@ -159,4 +205,8 @@ void interface_update_complete(struct interface *iface);
 
 void interface_start_pending(void);
 
+void interface_timing_mark(struct interface *iface, enum interface_timing_mark mark);
+void interface_timing_free(struct interface *iface);
+void interface_timing_dump(struct blob_buf *b, struct interface *iface);
+
 #endif
@@ -0,0 +1,368 @@
+/*
+ * netifd - network interface daemon
+ * Copyright (C) 2012 Felix Fietkau <nbd@openwrt.org>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2
+ * as published by the Free Software Foundation
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ */
+#include <string.h>
+#include <stdlib.h>
+#include <stdio.h>
+
+#include <arpa/inet.h>
+
+#include "netifd.h"
+#include "device.h"
+#include "interface.h"
+#include "iprule.h"
+#include "system.h"
+
+struct vlist_tree iprules;
+
+enum {
+	RULE_INTERFACE_IN,
+	RULE_INTERFACE_OUT,
+	RULE_SRC,
+	RULE_DEST,
+	RULE_PRIORITY,
+	RULE_TOS,
+	RULE_FWMARK,
+	RULE_LOOKUP,
+	RULE_ACTION,
+	RULE_GOTO,
+	RULE_INVERT,
+	__RULE_MAX
+};
+
+static const struct blobmsg_policy rule_attr[__RULE_MAX] = {
+	[RULE_INTERFACE_IN] = { .name = "in", .type = BLOBMSG_TYPE_STRING },
+	[RULE_INTERFACE_OUT] = { .name = "out", .type = BLOBMSG_TYPE_STRING },
+	[RULE_SRC] = { .name = "src", .type = BLOBMSG_TYPE_STRING },
+	[RULE_DEST] = { .name = "dest", .type = BLOBMSG_TYPE_STRING },
+	[RULE_PRIORITY] = { .name = "priority", .type = BLOBMSG_TYPE_INT32 },
+	[RULE_TOS] = { .name = "tos", .type = BLOBMSG_TYPE_INT32 },
+	[RULE_FWMARK] = { .name = "mark", .type = BLOBMSG_TYPE_STRING },
+	[RULE_LOOKUP] = { .name = "lookup", .type = BLOBMSG_TYPE_STRING },
+	[RULE_ACTION] = { .name = "action", .type = BLOBMSG_TYPE_STRING },
+	[RULE_GOTO] = { .name = "goto", .type = BLOBMSG_TYPE_INT32 },
+	[RULE_INVERT] = { .name = "invert", .type = BLOBMSG_TYPE_BOOL },
+};
+
+const struct config_param_list rule_attr_list = {
+	.n_params = __RULE_MAX,
+	.params = rule_attr,
+};
+
+static bool
+iprule_parse_mark(const char *str, struct iprule *rule)
+{
+	char *s, *e;
+	unsigned int n;
+
+	s = strchr(str, '/');
+	if (s) {
+		n = strtoul(s + 1, &e, 0);
+		if (*e || e == s + 1)
+			return false;
+
+		rule->fwmask = n;
+		rule->flags |= IPRULE_FWMASK;
+	}
+
+	n = strtoul(str, &e, 0);
+	if (e == str || (*e && e != s))
+		return false;
+
+	rule->fwmark = n;
+	rule->flags |= IPRULE_FWMARK;
+	return true;
+}
+
+void
+iprule_add(struct blob_attr *attr, bool v6)
+{
+	struct blob_attr *tb[__RULE_MAX], *cur;
+	struct iprule *rule;
+	int af = v6 ? AF_INET6 : AF_INET;
+	size_t len = 0;
+	char *buf;
+
+	blobmsg_parse(rule_attr, __RULE_MAX, tb, blob_data(attr), blob_len(attr));
+
+	if ((cur = tb[RULE_INTERFACE_IN]) != NULL)
+		len += strlen(blobmsg_data(cur)) + 1;
+
+	if ((cur = tb[RULE_INTERFACE_OUT]) != NULL)
+		len += strlen(blobmsg_data(cur)) + 1;
+
+	rule = calloc(1, sizeof(*rule) + len);
+	if (!rule)
+		return;
+
+	rule->flags = v6 ? IPRULE_INET6 : IPRULE_INET4;
+	rule->invert = blobmsg_get_bool_default(tb[RULE_INVERT], false);
+
+	/* the devices are looked up when the interfaces come up */
+	buf = rule->buf;
+	if ((cur = tb[RULE_INTERFACE_IN]) != NULL) {
+		rule->in_iface = strcpy(buf, blobmsg_data(cur));
+		buf += strlen(buf) + 1;
+		rule->flags |= IPRULE_IN;
+	}
+
+	if ((cur = tb[RULE_INTERFACE_OUT]) != NULL) {
+		rule->out_iface = strcpy(buf, blobmsg_data(cur));
+		rule->flags |= IPRULE_OUT;
+	}
+
+	if ((cur = tb[RULE_SRC]) != NULL) {
+		if (!parse_ip_and_netmask(af, blobmsg_data(cur), &rule->src_addr,
+					  &rule->src_mask)) {
+			DPRINTF("Failed to parse rule source: %s\n", (char *) blobmsg_data(cur));
+			goto error;
+		}
+
+		rule->flags |= IPRULE_SRC;
+	}
+
+	if ((cur = tb[RULE_DEST]) != NULL) {
+		if (!parse_ip_and_netmask(af, blobmsg_data(cur), &rule->dest_addr,
+					  &rule->dest_mask)) {
+			DPRINTF("Failed to parse rule destination: %s\n", (char *) blobmsg_data(cur));
+			goto error;
+		}
+
+		rule->flags |= IPRULE_DEST;
+	}
+
+	if ((cur = tb[RULE_PRIORITY]) != NULL) {
+		rule->priority = blobmsg_get_u32(cur);
+		rule->flags |= IPRULE_PRIORITY;
+	}
+
+	if ((cur = tb[RULE_TOS]) != NULL) {
+		if ((rule->tos = blobmsg_get_u32(cur)) > 255) {
+			DPRINTF("Invalid TOS value: %u\n", rule->tos);
+			goto error;
+		}
+
+		rule->flags |= IPRULE_TOS;
+	}
+
+	if ((cur = tb[RULE_FWMARK]) != NULL) {
+		if (!iprule_parse_mark(blobmsg_data(cur), rule)) {
+			DPRINTF("Failed to parse rule fwmark: %s\n", (char *) blobmsg_data(cur));
+			goto error;
+		}
+	}
+
+	if ((cur = tb[RULE_LOOKUP]) != NULL) {
+		if (!system_resolve_rt_table(blobmsg_data(cur), &rule->lookup)) {
+			DPRINTF("Failed to parse rule lookup table: %s\n", (char *) blobmsg_data(cur));
+			goto error;
+		}
+
+		rule->flags |= IPRULE_LOOKUP;
+	}
+
+	if ((cur = tb[RULE_ACTION]) != NULL) {
+		if (!system_resolve_iprule_action(blobmsg_data(cur), &rule->action)) {
+			DPRINTF("Failed to parse rule action: %s\n", (char *) blobmsg_data(cur));
+			goto error;
+		}
+
+		rule->flags |= IPRULE_ACTION;
+	}
+
+	if ((cur = tb[RULE_GOTO]) != NULL) {
+		rule->gotoid = blobmsg_get_u32(cur);
+		rule->flags |= IPRULE_GOTO;
+	}
+
+	vlist_add(&iprules, &rule->node, rule);
+	return;
+
+error:
+	free(rule);
+}
+
+void
+iprule_update_start(void)
+{
+	vlist_update(&iprules);
+}
+
+void
+iprule_update_complete(void)
+{
+	system_batch_start();
+	vlist_flush(&iprules);
+	system_batch_end();
+}
+
+static int
+rule_cmp(const void *k1, const void *k2, void *ptr)
+{
+	const struct iprule *r1 = k1, *r2 = k2;
+	int ret;
+
+	ret = memcmp(&r1->flags, &r2->flags,
+		     offsetof(struct iprule, in_iface) - offsetof(struct iprule, flags));
+	if (ret)
+		return ret;
+
+	ret = strcmp(r1->in_iface ? r1->in_iface : "", r2->in_iface ? r2->in_iface : "");
+	if (ret)
+		return ret;
+
+	return strcmp(r1->out_iface ? r1->out_iface : "", r2->out_iface ? r2->out_iface : "");
+}
+
+static void
+iprule_install(struct iprule *rule)
+{
+	if (rule->installed)
+		return;
+
+	if ((rule->flags & IPRULE_IN) && !rule->in_dev[0])
+		return;
+
+	if ((rule->flags & IPRULE_OUT) && !rule->out_dev[0])
+		return;
+
+	system_add_iprule(rule);
+	rule->installed = true;
+}
+
+static void
+iprule_uninstall(struct iprule *rule)
+{
+	if (!rule->installed)
+		return;
+
+	system_del_iprule(rule);
+	rule->installed = false;
+}
+
+/* track the device of an interface the rule refers to */
+static void
+iprule_iface_event(struct iprule *rule, struct interface_user *dep, char *dev_name,
+		   struct interface *iface, enum interface_event ev)
+{
+	struct device *dev;
+
+	if (ev == IFEV_RELOAD)
+		return;
+
+	iprule_uninstall(rule);
+	dev_name[0] = 0;
+
+	switch (ev) {
+	case IFEV_UP:
+	case IFEV_UPDATE:
+		dev = iface->l3_dev.dev;
+		if (!dev)
+			dev = iface->main_dev.dev;
+		if (dev)
+			strcpy(dev_name, dev->ifname);
+		break;
+	case IFEV_FREE:
+		interface_remove_user(dep);
+		break;
+	default:
+		break;
+	}
+
+	iprule_install(rule);
+}
+
+static void
+iprule_in_cb(struct interface_user *dep, struct interface *iface, enum interface_event ev)
+{
+	struct iprule *rule = container_of(dep, struct iprule, in_iface_user);
+
+	iprule_iface_event(rule, dep, rule->in_dev, iface, ev);
+}
+
+static void
+iprule_out_cb(struct interface_user *dep, struct interface *iface, enum interface_event ev)
+{
+	struct iprule *rule = container_of(dep, struct iprule, out_iface_user);
+
+	iprule_iface_event(rule, dep, rule->out_dev, iface, ev);
+}
+
+static void
+iprule_attach_interface(struct interface_user *dep, const char *name)
+{
+	struct interface *iface;
+
+	if (dep->iface)
+		return;
+
+	iface = vlist_find(&interfaces, name, iface, node);
+	if (!iface) {
+		DPRINTF("Unknown interface '%s' in rule\n", name);
+		return;
+	}
+
+	/* delivers IFEV_UP right away if the interface is up */
+	interface_add_user(dep, iface);
+}
+
+static void
+iprule_attach(struct iprule *rule)
+{
+	if (rule->flags & IPRULE_IN)
+		iprule_attach_interface(&rule->in_iface_user, rule->in_iface);
+
+	if (rule->flags & IPRULE_OUT)
+		iprule_attach_interface(&rule->out_iface_user, rule->out_iface);
+
+	iprule_install(rule);
+}
+
+static void
+iprule_update_rule(struct vlist_tree *tree,
+		   struct vlist_node *node_new, struct vlist_node *node_old)
+{
+	struct iprule *rule_old, *rule_new;
+
+	rule_old = container_of(node_old, struct iprule, node);
+	rule_new = container_of(node_new, struct iprule, node);
+
+	/* an identical rule already exists, its interfaces may be new */
+	if (node_old && node_new) {
+		free(rule_new);
+		iprule_attach(rule_old);
+		return;
+	}
+
+	if (node_old) {
+		iprule_uninstall(rule_old);
+		if (rule_old->in_iface_user.iface)
+			interface_remove_user(&rule_old->in_iface_user);
+		if (rule_old->out_iface_user.iface)
+			interface_remove_user(&rule_old->out_iface_user);
+		free(rule_old);
+	}
+
+	if (node_new) {
+		rule_new->in_iface_user.cb = iprule_in_cb;
+		rule_new->out_iface_user.cb = iprule_out_cb;
+		iprule_attach(rule_new);
+	}
+}
+
+static void __init
+iprule_init_list(void)
+{
+	vlist_init(&iprules, rule_cmp, iprule_update_rule);
+	iprules.keep_old = true;
+}
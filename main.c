@@ -19,6 +19,9 @@
 #include <signal.h>
 #include <stdarg.h>
 #include <syslog.h>
+#include <time.h>
+
+#include <libubox/avl-cmp.h>
 
 #include "netifd.h"
 #include "ubus.h"
@@ -29,6 +32,8 @@
 unsigned int debug_mask = 0;
 const char *main_path = DEFAULT_MAIN_PATH;
 const char *resolv_conf = DEFAULT_RESOLV_CONF;
+bool ip_repair = false;
+struct netifd_stats netifd_stats;
 static char **global_argv;
 
 static struct list_head process_list = LIST_HEAD_INIT(process_list);
@@ -82,6 +87,197 @@ netifd_log_message(int priority, const char *format, ...)
 	va_end(vl);
 }
 
+/*
+ * Output of child processes is stored in a fixed size ring of records and
+ * passed on to syslog in batches. Records stay available for reading over
+ * ubus after they have been flushed, until they get overwritten. A record
+ * is never overwritten before it has been flushed.
+ *
+ * Records refer to an interned copy of the prefix, which is shared by all
+ * records of the same interface and freed along with the last one.
+ */
+struct netifd_log_name {
+	struct avl_node avl;
+	unsigned int refcount;
+	char name[];
+};
+
+struct netifd_log_record {
+	time_t time;
+	int pid;
+	int priority;
+	struct netifd_log_name *prefix;
+	char msg[LOG_BUF_SIZE + 6];
+};
+
+static struct avl_tree log_names;
+
+static struct netifd_log_record log_ring[LOG_RING_SIZE];
+static unsigned int log_ring_head, log_ring_flushed;
+static struct uloop_timeout log_flush_timer;
+
+static const char * const log_priority_names[] = {
+	[L_CRIT] = "crit",
+	[L_WARNING] = "warning",
+	[L_NOTICE] = "notice",
+	[L_INFO] = "info",
+	[L_DEBUG] = "debug",
+};
+
+static struct netifd_log_name *
+netifd_log_name_get(const char *prefix)
+{
+	struct netifd_log_name *ln;
+
+	if (!log_names.comp)
+		avl_init(&log_names, avl_strcmp, false, NULL);
+
+	ln = avl_find_element(&log_names, prefix, ln, avl);
+	if (!ln) {
+		ln = calloc(1, sizeof(*ln) + strlen(prefix) + 1);
+		if (!ln)
+			return NULL;
+
+		strcpy(ln->name, prefix);
+		ln->avl.key = ln->name;
+		avl_insert(&log_names, &ln->avl);
+	}
+
+	ln->refcount++;
+	return ln;
+}
+
+static void
+netifd_log_name_put(struct netifd_log_name *ln)
+{
+	if (!ln || --ln->refcount)
+		return;
+
+	avl_delete(&log_names, &ln->avl);
+	free(ln);
+}
+
+/*
+ * Pass all unflushed records to syslog, with one message per process and
+ * priority. The lines of a process are joined up to LOG_FLUSH_BUF_SIZE
+ * bytes, so a burst of script output costs a few syslog calls instead of
+ * one per line.
+ */
+void
+netifd_log_flush(void)
+{
+	struct netifd_log_record *rec, *cur;
+	bool sent[LOG_RING_SIZE] = {};
+	char buf[LOG_FLUSH_BUF_SIZE];
+	unsigned int i, j, n;
+	int len;
+
+	uloop_timeout_cancel(&log_flush_timer);
+
+	n = log_ring_head - log_ring_flushed;
+	for (i = 0; i < n; i++) {
+		if (sent[i])
+			continue;
+
+		rec = &log_ring[(log_ring_flushed + i) % LOG_RING_SIZE];
+		len = 0;
+		for (j = i; j < n; j++) {
+			cur = &log_ring[(log_ring_flushed + j) % LOG_RING_SIZE];
+			if (sent[j] || cur->pid != rec->pid ||
+			    cur->priority != rec->priority ||
+			    cur->prefix != rec->prefix)
+				continue;
+
+			if (len && len + strlen(cur->msg) + 2 > sizeof(buf))
+				break;
+
+			len += snprintf(buf + len, sizeof(buf) - len, "%s%s",
+					len ? "\n" : "", cur->msg);
+			sent[j] = true;
+		}
+
+		/* lines left over when buf is full start their own message */
+		netifd_log_message(rec->priority, "%s (%d): %s\n",
+			rec->prefix->name, rec->pid, buf);
+	}
+
+	log_ring_flushed = log_ring_head;
+}
+
+static void
+netifd_log_flush_cb(struct uloop_timeout *timeout)
+{
+	netifd_log_flush();
+}
+
+static void
+netifd_log_record(int priority, const char *prefix, int pid, const char *msg,
+		  bool overflow)
+{
+	struct netifd_log_record *rec;
+	struct netifd_log_name *name;
+
+	name = netifd_log_name_get(prefix);
+	if (!name)
+		return;
+
+	/* the ring is full of records that have not reached syslog yet */
+	if (log_ring_head - log_ring_flushed >= LOG_RING_SIZE)
+		netifd_log_flush();
+
+	rec = &log_ring[log_ring_head++ % LOG_RING_SIZE];
+	rec->time = time(NULL);
+	rec->pid = pid;
+	rec->priority = priority;
+	netifd_log_name_put(rec->prefix);
+	rec->prefix = name;
+	snprintf(rec->msg, sizeof(rec->msg), "%s%s", msg, overflow ? " [...]" : "");
+
+	if (!log_flush_timer.pending) {
+		log_flush_timer.cb = netifd_log_flush_cb;
+		uloop_timeout_set(&log_flush_timer, LOG_FLUSH_INTERVAL);
+	}
+}
+
+void
+netifd_log_dump(struct blob_buf *b, const char *prefix, int count)
+{
+	struct netifd_log_record *rec;
+	unsigned int start, seq;
+	void *a, *t;
+	int n = 0;
+
+	start = log_ring_head;
+	if (log_ring_head > LOG_RING_SIZE)
+		seq = log_ring_head - LOG_RING_SIZE;
+	else
+		seq = 0;
+
+	/* walk backwards to find the oldest of the last n matching records */
+	while (start != seq && (count <= 0 || n < count)) {
+		rec = &log_ring[(start - 1) % LOG_RING_SIZE];
+		if (!prefix || !strcmp(rec->prefix->name, prefix))
+			n++;
+		start--;
+	}
+
+	a = blobmsg_open_array(b, "log");
+	for (seq = start; seq != log_ring_head; seq++) {
+		rec = &log_ring[seq % LOG_RING_SIZE];
+		if (prefix && strcmp(rec->prefix->name, prefix) != 0)
+			continue;
+
+		t = blobmsg_open_table(b, NULL);
+		blobmsg_add_u32(b, "time", rec->time);
+		blobmsg_add_string(b, "interface", rec->prefix->name);
+		blobmsg_add_u32(b, "pid", rec->pid);
+		blobmsg_add_string(b, "priority", log_priority_names[rec->priority]);
+		blobmsg_add_string(b, "message", rec->msg);
+		blobmsg_close_table(b, t);
+	}
+	blobmsg_close_array(b, a);
+}
+
 static void
 netifd_process_log_cb(struct uloop_fd *fd, unsigned int events)
 {
@@ -123,8 +319,8 @@ retry:
 		*cur = 0;
 
 		if (!proc->log_overflow)
-			netifd_log_message(L_NOTICE, "%s (%d): %s\n",
-				log_prefix, proc->uloop.pid, buf);
+			netifd_log_record(L_NOTICE, log_prefix,
+				proc->uloop.pid, buf, false);
 		else
 			proc->log_overflow = false;
 
@@ -139,8 +335,8 @@ retry:
 	if (len == LOG_BUF_SIZE) {
 		if (!proc->log_overflow) {
 			proc->log_buf[LOG_BUF_SIZE] = 0;
-			netifd_log_message(L_NOTICE, "%s (%d): %s [...]\n",
-				log_prefix, proc->uloop.pid, proc->log_buf);
+			netifd_log_record(L_NOTICE, log_prefix,
+				proc->uloop.pid, proc->log_buf, true);
 			proc->log_overflow = true;
 		}
 		len = 0;
@@ -177,6 +373,7 @@ netifd_start_process(const char **argv, char **env, struct netifd_process *proc)
 	if (pipe(pfds) < 0)
 		return -1;
 
+	netifd_stats.forks++;
 	if ((pid = fork()) < 0)
 		goto error;
 
@@ -255,6 +452,7 @@ netifd_fd_delete(struct netifd_fd *fd)
 
 static void netifd_do_restart(struct uloop_timeout *timeout)
 {
+	netifd_log_flush();
 	execvp(global_argv[0], global_argv);
 }
 
@@ -290,6 +488,8 @@ static int usage(const char *progname)
 		" -l <level>:		Log output level (default: %d)\n"
 		" -S:			Use stderr instead of syslog for log messages\n"
 		"			(default: "DEFAULT_HOTPLUG_PATH")\n"
+		" -I:			Only publish network.interface, no per-interface objects\n"
+		" -R:			Restore addresses and routes deleted by other programs\n"
 		"\n", progname, main_path, DEFAULT_LOG_LEVEL);
 
 	return 1;
@@ -334,7 +534,7 @@ int main(int argc, char **argv)
 
 	global_argv = argv;
 
-	while ((ch = getopt(argc, argv, "d:s:p:h:r:l:S")) != -1) {
+	while ((ch = getopt(argc, argv, "d:s:p:h:r:l:SIR")) != -1) {
 		switch(ch) {
 		case 'd':
 			debug_mask = strtoul(optarg, NULL, 0);
@@ -356,6 +556,12 @@ int main(int argc, char **argv)
 			if (log_level >= ARRAY_SIZE(log_class))
 				log_level = ARRAY_SIZE(log_class) - 1;
 			break;
+		case 'I':
+			ubus_iface_objects = false;
+			break;
+		case 'R':
+			ip_repair = true;
+			break;
 #ifndef DUMMY_MODE
 		case 'S':
 			use_syslog = false;
@@ -384,6 +590,7 @@ int main(int argc, char **argv)
 
 	uloop_run();
 	netifd_kill_processes();
+	netifd_log_flush();
 
 	netifd_ubus_done();
 
@@ -39,6 +39,7 @@
 extern const char *resolv_conf;
 extern char *hotplug_cmd_path;
 extern unsigned int debug_mask;
+extern bool ip_repair;
 
 enum {
 	L_CRIT,
@@ -65,7 +66,10 @@ enum {
 #define D(level, format, ...) no_debug(DEBUG_ ## level, format, ## __VA_ARGS__)
 #endif
 
-#define LOG_BUF_SIZE	256
+#define LOG_BUF_SIZE	512
+#define LOG_RING_SIZE	128
+#define LOG_FLUSH_INTERVAL	200
+#define LOG_FLUSH_BUF_SIZE	(4 * LOG_BUF_SIZE)
 
 static inline void no_debug(int level, const char *fmt, ...)
 {
@@ -91,7 +95,28 @@ struct netifd_process {
 	bool log_overflow;
 };
 
+struct netifd_stats {
+	unsigned int rtnl_requests;
+	unsigned int rtnl_acks;
+	unsigned int rtnl_batch_errors;
+	unsigned int ioctls;
+	unsigned int sysfs_opens;
+	unsigned int forks;
+	unsigned int resolv_conf_writes;
+	unsigned int config_reloads;
+	unsigned int config_reload_time;
+	unsigned int config_reload_time_max;
+	unsigned int proto_updates;
+	unsigned int proto_updates_skipped;
+	unsigned int addr_repairs;
+	unsigned int route_repairs;
+};
+
+extern struct netifd_stats netifd_stats;
+
 void netifd_log_message(int priority, const char *format, ...);
+void netifd_log_flush(void);
+void netifd_log_dump(struct blob_buf *b, const char *prefix, int count);
 
 int netifd_start_process(const char **argv, char **env, struct netifd_process *proc);
 void netifd_kill_process(struct netifd_process *proc);
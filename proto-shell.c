@@ -30,6 +30,7 @@
 #include "interface.h"
 #include "interface-ip.h"
 #include "proto.h"
+#include "system.h"
 
 static struct netifd_fd proto_fd;
 
@@ -55,10 +56,18 @@ struct proto_shell_dependency {
 	struct proto_shell_state *proto;
 	struct interface_user dep;
 
+	/* unresolved dependencies are indexed by host address */
+	struct avl_node avl;
+	struct list_head recheck;
+	bool pending;
+
 	union if_addr host;
 	bool v6;
 };
 
+static struct avl_tree host_deps[2];
+static struct interface_user host_dep_user;
+
 struct proto_shell_state {
 	struct interface_proto_state proto;
 	struct proto_shell_handler *handler;
@@ -94,13 +103,27 @@ proto_shell_check_dependencies(struct proto_shell_state *state)
 	interface_set_available(state->proto.iface, available);
 }
 
-static void
-proto_shell_if_up_cb(struct interface_user *dep, struct interface *iface,
-		     enum interface_event ev);
 static void
 proto_shell_if_down_cb(struct interface_user *dep, struct interface *iface,
 		       enum interface_event ev);
 
+static void
+proto_shell_set_host_dep_pending(struct proto_shell_dependency *dep, bool pending)
+{
+	struct avl_tree *tree = &host_deps[dep->v6];
+
+	if (dep->pending == pending)
+		return;
+
+	dep->pending = pending;
+	if (pending) {
+		dep->avl.key = &dep->host;
+		avl_insert(tree, &dep->avl);
+	} else {
+		avl_delete(tree, &dep->avl);
+	}
+}
+
 static void
 proto_shell_update_host_dep(struct proto_shell_dependency *dep)
 {
@@ -110,10 +133,12 @@ proto_shell_update_host_dep(struct proto_shell_dependency *dep)
 		goto out;
 
 	iface = interface_ip_add_target_route(&dep->host, dep->v6);
-	if (!iface)
+	if (!iface) {
+		proto_shell_set_host_dep_pending(dep, true);
 		goto out;
+	}
 
-	interface_remove_user(&dep->dep);
+	proto_shell_set_host_dep_pending(dep, false);
 	dep->dep.cb = proto_shell_if_down_cb;
 	interface_add_user(&dep->dep, iface);
 
@@ -128,11 +153,106 @@ proto_shell_clear_host_dep(struct proto_shell_state *state)
 
 	list_for_each_entry_safe(dep, tmp, &state->deps, list) {
 		interface_remove_user(&dep->dep);
+		proto_shell_set_host_dep_pending(dep, false);
+		list_del(&dep->recheck);
 		list_del(&dep->list);
 		free(dep);
 	}
 }
 
+/* queue the pending dependencies with a host address inside the prefix */
+static void
+proto_shell_find_host_deps(union if_addr *addr, unsigned int mask, bool v6,
+			   struct list_head *list)
+{
+	struct avl_tree *tree = &host_deps[v6];
+	struct proto_shell_dependency *dep;
+	union if_addr start = {}, end = {};
+	uint8_t *s = (uint8_t *) &start, *e = (uint8_t *) &end;
+	int i, bits, len = v6 ? 16 : 4;
+
+	if (!tree->count)
+		return;
+
+	memcpy(&start, addr, len);
+	for (i = 0; i < len; i++) {
+		bits = mask - i * 8;
+		if (bits >= 8)
+			bits = 8;
+		else if (bits < 0)
+			bits = 0;
+
+		s[i] &= 0xff << (8 - bits);
+		e[i] = s[i] | (0xff >> bits);
+	}
+
+	dep = avl_find_ge_element(tree, &start, dep, avl);
+	while (dep && memcmp(&dep->host, &end, sizeof(end)) <= 0) {
+		if (list_empty(&dep->recheck))
+			list_add_tail(&dep->recheck, list);
+
+		if (avl_is_last(tree, &dep->avl))
+			break;
+
+		dep = avl_next_element(dep, avl);
+	}
+}
+
+static void
+proto_shell_find_iface_host_deps(struct interface_ip_settings *ip,
+				 struct list_head *list)
+{
+	struct device_addr *addr;
+	struct device_route *route;
+	bool v6;
+
+	vlist_for_each_element(&ip->addr, addr, node) {
+		if (!addr->enabled)
+			continue;
+
+		v6 = (addr->flags & DEVADDR_FAMILY) == DEVADDR_INET6;
+		proto_shell_find_host_deps(&addr->addr, addr->mask, v6, list);
+	}
+
+	vlist_for_each_element(&ip->route, route, node) {
+		if (!route->enabled)
+			continue;
+
+		v6 = (route->flags & DEVADDR_FAMILY) == DEVADDR_INET6;
+		proto_shell_find_host_deps(&route->addr, route->mask, v6, list);
+	}
+}
+
+/*
+ * An interface coming up can only resolve the dependencies whose host is
+ * covered by one of its addresses or routes, only those are looked up again.
+ */
+static void
+proto_shell_host_dep_cb(struct interface_user *dep, struct interface *iface,
+			enum interface_event ev)
+{
+	struct proto_shell_dependency *pdep;
+	LIST_HEAD(recheck);
+
+	if (ev != IFEV_UP)
+		return;
+
+	proto_shell_find_iface_host_deps(&iface->proto_ip, &recheck);
+	proto_shell_find_iface_host_deps(&iface->config_ip, &recheck);
+
+	while (!list_empty(&recheck)) {
+		pdep = list_first_entry(&recheck, struct proto_shell_dependency, recheck);
+		list_del_init(&pdep->recheck);
+		proto_shell_update_host_dep(pdep);
+	}
+}
+
+static int
+host_dep_cmp(const void *k1, const void *k2, void *ptr)
+{
+	return memcmp(k1, k2, sizeof(union if_addr));
+}
+
 static int
 proto_shell_handler(struct interface_proto_state *proto,
 		    enum interface_proto_cmd cmd, bool force)
@@ -199,19 +319,6 @@ proto_shell_handler(struct interface_proto_state *proto,
 	return ret;
 }
 
-static void
-proto_shell_if_up_cb(struct interface_user *dep, struct interface *iface,
-		     enum interface_event ev)
-{
-	struct proto_shell_dependency *pdep;
-
-	if (ev != IFEV_UP)
-		return;
-
-	pdep = container_of(dep, struct proto_shell_dependency, dep);
-	proto_shell_update_host_dep(pdep);
-}
-
 static void
 proto_shell_if_down_cb(struct interface_user *dep, struct interface *iface,
 		       enum interface_event ev)
@@ -224,8 +331,7 @@ proto_shell_if_down_cb(struct interface_user *dep, struct interface *iface,
 
 	pdep = container_of(dep, struct proto_shell_dependency, dep);
 	interface_remove_user(dep);
-	dep->cb = proto_shell_if_up_cb;
-	interface_add_user(dep, NULL);
+	proto_shell_set_host_dep_pending(pdep, true);
 
 	state = pdep->proto;
 	if (state->sm == S_IDLE) {
@@ -340,6 +446,23 @@ proto_shell_parse_route_list(struct interface *iface, struct blob_attr *attr,
 	}
 }
 
+static void
+proto_shell_parse_route_sets(struct interface *iface, struct blob_attr *attr,
+			     bool v6)
+{
+	struct blob_attr *cur;
+	int rem;
+
+	blobmsg_for_each_attr(cur, attr, rem) {
+		if (blobmsg_type(cur) != BLOBMSG_TYPE_TABLE) {
+			DPRINTF("Ignore wrong route set type: %d\n", blobmsg_type(cur));
+			continue;
+		}
+
+		interface_ip_add_route_set(iface, cur, v6);
+	}
+}
+
 static void
 proto_shell_parse_data(struct interface *iface, struct blob_attr *attr)
 {
@@ -377,6 +500,8 @@ enum {
 	NOTIFY_ADDR_EXT,
 	NOTIFY_ROUTES,
 	NOTIFY_ROUTES6,
+	NOTIFY_ROUTES_BULK,
+	NOTIFY_ROUTES6_BULK,
 	NOTIFY_TUNNEL,
 	NOTIFY_DATA,
 	NOTIFY_KEEP,
@@ -398,6 +523,8 @@ static const struct blobmsg_policy notify_attr[__NOTIFY_LAST] = {
 	[NOTIFY_ADDR_EXT] = { .name = "address-external", .type = BLOBMSG_TYPE_BOOL },
 	[NOTIFY_ROUTES] = { .name = "routes", .type = BLOBMSG_TYPE_ARRAY },
 	[NOTIFY_ROUTES6] = { .name = "routes6", .type = BLOBMSG_TYPE_ARRAY },
+	[NOTIFY_ROUTES_BULK] = { .name = "routes-bulk", .type = BLOBMSG_TYPE_ARRAY },
+	[NOTIFY_ROUTES6_BULK] = { .name = "routes6-bulk", .type = BLOBMSG_TYPE_ARRAY },
 	[NOTIFY_TUNNEL] = { .name = "tunnel", .type = BLOBMSG_TYPE_TABLE },
 	[NOTIFY_DATA] = { .name = "data", .type = BLOBMSG_TYPE_TABLE },
 	[NOTIFY_KEEP] = { .name = "keep", .type = BLOBMSG_TYPE_BOOL },
@@ -417,6 +544,7 @@ proto_shell_update_link(struct proto_shell_state *state, struct blob_attr *data,
 	bool addr_ext = false;
 	bool keep = false;
 	bool up;
+	uint64_t hash;
 
 	if (!tb[NOTIFY_LINK_UP])
 		return UBUS_STATUS_INVALID_ARGUMENT;
@@ -430,6 +558,22 @@ proto_shell_update_link(struct proto_shell_state *state, struct blob_attr *data,
 	if ((cur = tb[NOTIFY_KEEP]) != NULL)
 		keep = blobmsg_get_bool(cur);
 
+	netifd_stats.proto_updates++;
+	iface->update_time = system_get_rtime();
+
+	/*
+	 * renewals usually repeat the previous update, skip rebuilding the
+	 * address and route lists if nothing has changed since
+	 */
+	hash = fnv1a_hash64(blob_data(data), blob_len(data));
+	if (!keep && iface->state == IFS_UP && iface->proto_ip.hash == hash) {
+		netifd_stats.proto_updates_skipped++;
+		state->sm = S_IDLE;
+		return 0;
+	}
+
+	interface_timing_mark(iface, IFT_PROTO_UPDATE);
+
 	if ((cur = tb[NOTIFY_ADDR_EXT]) != NULL) {
 		addr_ext = blobmsg_get_bool(cur);
 		if (addr_ext)
@@ -457,6 +601,10 @@ proto_shell_update_link(struct proto_shell_state *state, struct blob_attr *data,
 		device_claim(&iface->l3_dev);
 	}
 
+	/* the kernel is programmed while the settings are parsed, collect
+	 * the acks of all requests at the end */
+	system_batch_start();
+
 	if (!keep)
 		interface_update_start(iface);
 
@@ -468,6 +616,12 @@ proto_shell_update_link(struct proto_shell_state *state, struct blob_attr *data,
 	if ((cur = tb[NOTIFY_ROUTES6]) != NULL)
 		proto_shell_parse_route_list(state->proto.iface, cur, true);
 
+	if ((cur = tb[NOTIFY_ROUTES_BULK]) != NULL)
+		proto_shell_parse_route_sets(state->proto.iface, cur, false);
+
+	if ((cur = tb[NOTIFY_ROUTES6_BULK]) != NULL)
+		proto_shell_parse_route_sets(state->proto.iface, cur, true);
+
 	if ((cur = tb[NOTIFY_DNS]))
 		interface_add_dns_server_list(&iface->proto_ip, cur);
 
@@ -475,6 +629,10 @@ proto_shell_update_link(struct proto_shell_state *state, struct blob_attr *data,
 		interface_add_dns_search_list(&iface->proto_ip, cur);
 
 	interface_update_complete(state->proto.iface);
+	system_batch_end();
+
+	/* incremental updates leave the previous settings in place */
+	iface->proto_ip.hash = keep ? 0 : hash;
 
 	if (!keep)
 		state->proto.proto_event(&state->proto, IFPEV_UP);
@@ -624,8 +782,8 @@ proto_shell_add_host_dependency(struct proto_shell_state *state, struct blob_att
 	}
 
 	dep->proto = state;
-	dep->dep.cb = proto_shell_if_up_cb;
-	interface_add_user(&dep->dep, NULL);
+	INIT_LIST_HEAD(&dep->dep.list);
+	INIT_LIST_HEAD(&dep->recheck);
 	list_add(&dep->list, &state->deps);
 	proto_shell_update_host_dep(dep);
 	if (!dep->dep.iface)
@@ -894,6 +1052,12 @@ static void __init proto_shell_init(void)
 	int main_fd;
 	int i;
 
+	for (i = 0; i < ARRAY_SIZE(host_deps); i++)
+		avl_init(&host_deps[i], host_dep_cmp, true, NULL);
+
+	host_dep_user.cb = proto_shell_host_dep_cb;
+	interface_add_user(&host_dep_user, NULL);
+
 	main_fd = open(".", O_RDONLY | O_DIRECTORY);
 	if (main_fd < 0)
 		return;
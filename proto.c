@@ -32,6 +32,7 @@ enum {
 	OPT_BROADCAST,
 	OPT_GATEWAY,
 	OPT_IP6GW,
+	OPT_IP6PREFIX,
 	__OPT_MAX,
 };
 
@@ -42,11 +43,13 @@ static const struct blobmsg_policy proto_ip_attributes[__OPT_MAX] = {
 	[OPT_BROADCAST] = { .name = "broadcast", .type = BLOBMSG_TYPE_STRING },
 	[OPT_GATEWAY] = { .name = "gateway", .type = BLOBMSG_TYPE_STRING },
 	[OPT_IP6GW] = { .name = "ip6gw", .type = BLOBMSG_TYPE_STRING },
+	[OPT_IP6PREFIX] = { .name = "ip6prefix", .type = BLOBMSG_TYPE_ARRAY },
 };
 
 static const union config_param_info proto_ip_attr_info[__OPT_MAX] = {
 	[OPT_IPADDR] = { .type = BLOBMSG_TYPE_STRING },
 	[OPT_IP6ADDR] = { .type = BLOBMSG_TYPE_STRING },
+	[OPT_IP6PREFIX] = { .type = BLOBMSG_TYPE_STRING },
 };
 
 const struct config_param_list proto_ip_attr = {
@@ -75,9 +78,8 @@ alloc_device_addr(bool v6, bool ext)
 {
 	struct device_addr *addr;
 
-	addr = calloc(1, sizeof(*addr));
-	addr->flags = v6 ? DEVADDR_INET6 : DEVADDR_INET4;
-	if (ext)
+	addr = interface_ip_alloc_addr(v6);
+	if (addr && ext)
 		addr->flags |= DEVADDR_EXTERNAL;
 
 	return addr;
@@ -97,7 +99,7 @@ parse_addr(struct interface *iface, const char *str, bool v6, int mask,
 	addr->mask = mask;
 	if (!parse_ip_and_netmask(af, str, &addr->addr, &addr->mask)) {
 		interface_add_error(iface, "proto", "INVALID_ADDRESS", &str, 1);
-		free(addr);
+		interface_ip_free_addr(addr);
 		return false;
 	}
 
@@ -175,7 +177,7 @@ parse_address_item(struct blob_attr *attr, bool v6, bool ext)
 	return addr;
 
 error:
-	free(addr);
+	interface_ip_free_addr(addr);
 	return NULL;
 }
 
@@ -207,20 +209,52 @@ parse_gateway_option(struct interface *iface, struct blob_attr *attr, bool v6)
 	const char *str = blobmsg_data(attr);
 	int af = v6 ? AF_INET6 : AF_INET;
 
-	route = calloc(1, sizeof(*route));
+	route = interface_ip_alloc_route(v6);
+	if (!route)
+		return false;
+
 	if (!inet_pton(af, str, &route->nexthop)) {
 		interface_add_error(iface, "proto", "INVALID_GATEWAY", &str, 1);
-		free(route);
+		interface_ip_free_route(route);
 		return false;
 	}
 
 	route->mask = 0;
-	route->flags = (v6 ? DEVADDR_INET6 : DEVADDR_INET4);
-	vlist_add(&iface->proto_ip.route, &route->node, &route->flags);
+	route->table = interface_ip_table(iface, v6);
+	vlist_add(&iface->proto_ip.route, &route->node, &route->table);
 
 	return true;
 }
 
+static int
+parse_prefix_option(struct interface *iface, struct blob_attr *attr)
+{
+	struct blob_attr *cur;
+	struct in6_addr addr;
+	unsigned int length;
+	const char *str;
+	int n_prefix = 0;
+	int rem;
+
+	blobmsg_for_each_attr(cur, attr, rem) {
+		if (blobmsg_type(cur) != BLOBMSG_TYPE_STRING)
+			return -1;
+
+		str = blobmsg_data(cur);
+		length = 64;
+		if (!parse_ip_and_netmask(AF_INET6, str, &addr, &length) ||
+		    length > 64) {
+			interface_add_error(iface, "proto", "INVALID_PREFIX", &str, 1);
+			return -1;
+		}
+
+		n_prefix++;
+		interface_ip_add_device_prefix(iface, &addr, length);
+	}
+
+	return n_prefix;
+}
+
 int
 proto_apply_static_ip_settings(struct interface *iface, struct blob_attr *attr)
 {
@@ -228,7 +262,7 @@ proto_apply_static_ip_settings(struct interface *iface, struct blob_attr *attr)
 	struct blob_attr *cur;
 	const char *error;
 	unsigned int netmask = 32;
-	int n_v4 = 0, n_v6 = 0;
+	int n_v4 = 0, n_v6 = 0, n_prefix = 0;
 	struct in_addr bcast = {};
 
 	blobmsg_parse(proto_ip_attributes, __OPT_MAX, tb, blob_data(attr), blob_len(attr));
@@ -256,12 +290,15 @@ proto_apply_static_ip_settings(struct interface *iface, struct blob_attr *attr)
 		n_v6 = parse_static_address_option(iface, cur, true,
 			netmask, false, 0);
 
-	if (!n_v4 && !n_v6) {
+	if ((cur = tb[OPT_IP6PREFIX]))
+		n_prefix = parse_prefix_option(iface, cur);
+
+	if (!n_v4 && !n_v6 && !n_prefix) {
 		error = "NO_ADDRESS";
 		goto error;
 	}
 
-	if (n_v4 < 0 || n_v6 < 0)
+	if (n_v4 < 0 || n_v6 < 0 || n_prefix < 0)
 		goto out;
 
 	if ((cur = tb[OPT_GATEWAY])) {
@@ -288,7 +325,7 @@ proto_apply_ip_settings(struct interface *iface, struct blob_attr *attr, bool ex
 	struct blob_attr *tb[__OPT_MAX];
 	struct blob_attr *cur;
 	const char *error;
-	int n_v4 = 0, n_v6 = 0;
+	int n_v4 = 0, n_v6 = 0, n_prefix = 0;
 
 	blobmsg_parse(proto_ip_attributes, __OPT_MAX, tb, blob_data(attr), blob_len(attr));
 
@@ -298,12 +335,15 @@ proto_apply_ip_settings(struct interface *iface, struct blob_attr *attr, bool ex
 	if ((cur = tb[OPT_IP6ADDR]))
 		n_v6 = parse_address_list(iface, cur, true, ext);
 
-	if (!n_v4 && !n_v6) {
+	if ((cur = tb[OPT_IP6PREFIX]))
+		n_prefix = parse_prefix_option(iface, cur);
+
+	if (!n_v4 && !n_v6 && !n_prefix) {
 		error = "NO_ADDRESS";
 		goto error;
 	}
 
-	if (n_v4 < 0 || n_v6 < 0)
+	if (n_v4 < 0 || n_v6 < 0 || n_prefix < 0)
 		goto out;
 
 	if ((cur = tb[OPT_GATEWAY])) {
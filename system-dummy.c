@@ -13,6 +13,7 @@
  */
 #include <sys/time.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 
 #include <arpa/inet.h>
@@ -30,6 +31,14 @@ int system_init(void)
 	return 0;
 }
 
+void system_batch_start(void)
+{
+}
+
+void system_batch_end(void)
+{
+}
+
 int system_bridge_addbr(struct device *bridge, struct bridge_config *cfg)
 {
 	D(SYSTEM, "brctl addbr %s\n", bridge->ifname);
@@ -54,15 +63,30 @@ int system_bridge_delif(struct device *bridge, struct device *dev)
 	return 0;
 }
 
-int system_vlan_add(struct device *dev, int id)
+int system_bridge_vlan(struct device *dev, struct bridge_vlan_range *r, int n,
+		       bool add, bool self)
 {
-	D(SYSTEM, "vconfig add %s %d\n", dev->ifname, id);
+	int i;
+
+	for (i = 0; i < n; i++)
+		D(SYSTEM, "bridge vlan %s dev %s vid %d-%d%s%s%s\n",
+		  add ? "add" : "del", dev->ifname, r[i].vid, r[i].vid_end,
+		  (r[i].flags & BRVLAN_F_PVID) ? " pvid" : "",
+		  (r[i].flags & BRVLAN_F_UNTAGGED) ? " untagged" : "",
+		  self ? " self" : "");
 	return 0;
 }
 
+int system_vlan_add(struct device *dev, struct device *parent, int id)
+{
+	D(SYSTEM, "ip link add link %s name %s type vlan id %d\n",
+	  parent->ifname, dev->ifname, id);
+	return system_if_up(dev);
+}
+
 int system_vlan_del(struct device *dev)
 {
-	D(SYSTEM, "vconfig rem %s\n", dev->ifname);
+	D(SYSTEM, "ip link del %s\n", dev->ifname);
 	return 0;
 }
 
@@ -137,6 +161,26 @@ int system_add_address(struct device *dev, struct device_addr *addr)
 	return 0;
 }
 
+int system_add_address_noprefixroute(struct device *dev, struct device_addr *addr)
+{
+	return -1;
+}
+
+int system_restore_address(struct device *dev, struct device_addr *addr,
+			   bool noprefixroute)
+{
+	int ret;
+
+	if (noprefixroute)
+		return -1;
+
+	ret = system_add_address(dev, addr);
+	if (!ret)
+		netifd_stats.addr_repairs++;
+
+	return ret;
+}
+
 int system_del_address(struct device *dev, struct device_addr *addr)
 {
 	uint8_t *a = (uint8_t *) &addr->addr.in;
@@ -183,6 +227,17 @@ int system_add_route(struct device *dev, struct device_route *route)
 	return 0;
 }
 
+int system_restore_route(struct device *dev, struct device_route *route)
+{
+	int ret;
+
+	ret = system_add_route(dev, route);
+	if (!ret)
+		netifd_stats.route_repairs++;
+
+	return ret;
+}
+
 int system_del_route(struct device *dev, struct device_route *route)
 {
 	uint8_t *a1 = (uint8_t *) &route->addr.in;
@@ -208,11 +263,111 @@ int system_del_route(struct device *dev, struct device_route *route)
 	return 0;
 }
 
+static void system_mp_rt(struct device_mp_route *route, const char *cmd)
+{
+	uint8_t *a1 = (uint8_t *) &route->addr.in;
+	char addr[40];
+	int i;
+
+	if ((route->flags & DEVADDR_FAMILY) != DEVADDR_INET4)
+		return;
+
+	if (!route->mask)
+		sprintf(addr, "default");
+	else
+		sprintf(addr, "%d.%d.%d.%d/%d",
+			a1[0], a1[1], a1[2], a1[3], route->mask);
+
+	D(SYSTEM, "route %s %s metric %d\n", cmd, addr, route->metric);
+	for (i = 0; i < route->n_nexthops; i++) {
+		struct route_nexthop *nh = &route->nexthops[i];
+		uint8_t *a2 = (uint8_t *) &nh->gw.in;
+
+		if (!nh->dev || !strcmp(cmd, "del"))
+			continue;
+
+		D(SYSTEM, "    nexthop via %d.%d.%d.%d dev %s weight %d\n",
+		  a2[0], a2[1], a2[2], a2[3], nh->dev->ifname, nh->weight);
+	}
+}
+
+int system_add_mp_route(struct device_mp_route *route)
+{
+	system_mp_rt(route, "add");
+	return 0;
+}
+
+int system_del_mp_route(struct device_mp_route *route)
+{
+	system_mp_rt(route, "del");
+	return 0;
+}
+
 int system_flush_routes(void)
 {
 	return 0;
 }
 
+bool system_resolve_rt_table(const char *name, unsigned int *id)
+{
+	char *e;
+	unsigned int n;
+
+	if (!strcmp(name, "default"))
+		n = 253;
+	else if (!strcmp(name, "main"))
+		n = 254;
+	else if (!strcmp(name, "local"))
+		n = 255;
+	else {
+		n = strtoul(name, &e, 0);
+		if (*e || !n)
+			return false;
+	}
+
+	*id = n;
+	return true;
+}
+
+static int system_iprule(struct iprule *rule, const char *cmd)
+{
+	D(SYSTEM, "ip%s rule %s%s%s%s pref %u lookup %u\n",
+	  (rule->flags & IPRULE_INET6) ? " -6" : "", cmd,
+	  rule->invert ? " not" : "",
+	  (rule->flags & IPRULE_IN) ? " iif " : "",
+	  (rule->flags & IPRULE_IN) ? rule->in_dev : "",
+	  rule->priority, rule->lookup);
+	return 0;
+}
+
+int system_add_iprule(struct iprule *rule)
+{
+	return system_iprule(rule, "add");
+}
+
+int system_del_iprule(struct iprule *rule)
+{
+	return system_iprule(rule, "del");
+}
+
+bool system_resolve_iprule_action(const char *action, unsigned int *id)
+{
+	static const char * const actions[] = {
+		"unreachable", "prohibit", "blackhole", "throw",
+	};
+	int i;
+
+	for (i = 0; i < ARRAY_SIZE(actions); i++) {
+		if (strcmp(action, actions[i]) != 0)
+			continue;
+
+		*id = i + 1;
+		return true;
+	}
+
+	return false;
+}
+
 time_t system_get_rtime(void)
 {
 	struct timeval tv;
@@ -223,12 +378,22 @@ time_t system_get_rtime(void)
 	return 0;
 }
 
-int system_del_ip_tunnel(const char *name)
+uint64_t system_get_rtime_msec(void)
 {
+	struct timeval tv;
+
+	if (gettimeofday(&tv, NULL) == 0)
+		return (uint64_t) tv.tv_sec * 1000 + tv.tv_usec / 1000;
+
 	return 0;
 }
 
-int system_add_ip_tunnel(const char *name, struct blob_attr *attr)
+int system_del_ip_tunnel(const char *name)
 {
 	return 0;
 }
+
+int system_add_ip_tunnel(struct device *dev, struct blob_attr *attr)
+{
+	return system_if_up(dev);
+}
@@ -17,6 +17,7 @@
 #include <sys/ioctl.h>
 #include <sys/stat.h>
 #include <sys/syscall.h>
+#include <sys/utsname.h>
 
 #include <net/if.h>
 #include <net/if_arp.h>
@@ -30,6 +31,7 @@
 #include <linux/if_vlan.h>
 #include <linux/if_bridge.h>
 #include <linux/if_tunnel.h>
+#include <linux/fib_rules.h>
 #include <linux/ethtool.h>
 
 #include <unistd.h>
@@ -47,6 +49,17 @@
 #include "device.h"
 #include "system.h"
 
+#ifndef IFA_F_NOPREFIXROUTE
+#define IFA_F_NOPREFIXROUTE	0x200
+#endif
+
+/* outstanding acks of batched requests, and the buffer they go to */
+#define RTNL_BATCH_MAX		64
+#define RTNL_RCVBUF_SIZE	(256 * 1024)
+
+/* address and route events, bursts come with every bulk update */
+#define RTNL_EVENT_RCVBUF_SIZE	(1024 * 1024)
+
 struct event_socket {
 	struct uloop_fd uloop;
 	struct nl_sock *sock;
@@ -55,9 +68,14 @@ struct event_socket {
 
 static int sock_ioctl = -1;
 static struct nl_sock *sock_rtnl = NULL;
+static struct nl_cb *rtnl_cb = NULL;
 
 static int cb_rtnl_event(struct nl_msg *msg, void *arg);
+static int cb_rtnl_repair_event(struct nl_msg *msg, void *arg);
 static void handle_hotplug_event(struct uloop_fd *u, unsigned int events);
+static void handler_repair_event(struct uloop_fd *u, unsigned int events);
+static void system_if_get_link(struct device *dev, bool settings);
+static int system_if_up_ioctl(struct device *dev);
 
 static char dev_buf[256];
 
@@ -114,9 +132,39 @@ create_event_socket(struct event_socket *ev, int protocol,
 	return create_raw_event_socket(ev, protocol, 0, handler_nl_event);
 }
 
+/*
+ * Address and route events get their own socket: they include every
+ * change made by netifd itself, and an overflow must not cost link events.
+ */
+static bool
+create_repair_event_socket(struct event_socket *ev)
+{
+	ev->cb = nl_cb_alloc(NL_CB_DEFAULT);
+	if (!ev->cb)
+		return false;
+
+	nl_cb_set(ev->cb, NL_CB_VALID, NL_CB_CUSTOM, cb_rtnl_repair_event, NULL);
+
+	if (!create_raw_event_socket(ev, NETLINK_ROUTE, 0, handler_repair_event))
+		return false;
+
+	/* level triggered, a burst is read over several loop iterations */
+	uloop_fd_add(&ev->uloop, ULOOP_READ);
+
+	nl_socket_disable_seq_check(ev->sock);
+	nl_socket_set_nonblocking(ev->sock);
+	nl_socket_set_buffer_size(ev->sock, RTNL_EVENT_RCVBUF_SIZE, 0);
+	nl_socket_add_memberships(ev->sock,
+		RTNLGRP_IPV4_IFADDR, RTNLGRP_IPV6_IFADDR,
+		RTNLGRP_IPV4_ROUTE, RTNLGRP_IPV6_ROUTE, 0);
+
+	return true;
+}
+
 int system_init(void)
 {
 	static struct event_socket rtnl_event;
+	static struct event_socket repair_event;
 	static struct event_socket hotplug_event;
 
 	sock_ioctl = socket(AF_LOCAL, SOCK_DGRAM, 0);
@@ -127,6 +175,12 @@ int system_init(void)
 	if (!sock_rtnl)
 		return -1;
 
+	nl_socket_set_buffer_size(sock_rtnl, RTNL_RCVBUF_SIZE, 0);
+
+	rtnl_cb = nl_cb_alloc(NL_CB_DEFAULT);
+	if (!rtnl_cb)
+		return -1;
+
 	if (!create_event_socket(&rtnl_event, NETLINK_ROUTE, cb_rtnl_event))
 		return -1;
 
@@ -137,6 +191,10 @@ int system_init(void)
 	// Receive network link events form kernel
 	nl_socket_add_membership(rtnl_event.sock, RTNLGRP_LINK);
 
+	// Watch for addresses and routes removed behind our back
+	if (ip_repair && !create_repair_event_socket(&repair_event))
+		return -1;
+
 	return 0;
 }
 
@@ -144,6 +202,7 @@ static void system_set_sysctl(const char *path, const char *val)
 {
 	int fd;
 
+	netifd_stats.sysfs_opens++;
 	fd = open(path, O_WRONLY);
 	if (fd < 0)
 		return;
@@ -154,7 +213,7 @@ static void system_set_sysctl(const char *path, const char *val)
 
 static void system_set_dev_sysctl(const char *path, const char *device, const char *val)
 {
-	snprintf(dev_buf, sizeof(dev_buf), path, val);
+	snprintf(dev_buf, sizeof(dev_buf), path, device);
 	system_set_sysctl(dev_buf, val);
 }
 
@@ -163,6 +222,189 @@ static void system_set_disable_ipv6(struct device *dev, const char *val)
 	system_set_dev_sysctl("/proc/sys/net/ipv6/conf/%s/disable_ipv6", dev->ifname, val);
 }
 
+/* returns the ifindex of the address, or -1 if it is not of interest */
+static int system_parse_addr(struct nlmsghdr *nh, struct device_addr *addr)
+{
+	struct ifaddrmsg *ifa = NLMSG_DATA(nh);
+	struct nlattr *nla[__IFA_MAX], *cur;
+	int alen;
+
+	if (ifa->ifa_family != AF_INET && ifa->ifa_family != AF_INET6)
+		return -1;
+
+	nlmsg_parse(nh, sizeof(*ifa), nla, __IFA_MAX - 1, NULL);
+	cur = nla[IFA_LOCAL] ? nla[IFA_LOCAL] : nla[IFA_ADDRESS];
+	alen = (ifa->ifa_family == AF_INET) ? 4 : 16;
+	if (!cur || nla_len(cur) != alen)
+		return -1;
+
+	memset(addr, 0, sizeof(*addr));
+	addr->flags = (alen == 4) ? DEVADDR_INET4 : DEVADDR_INET6;
+	addr->mask = ifa->ifa_prefixlen;
+	memcpy(&addr->addr, nla_data(cur), alen);
+
+	return ifa->ifa_index;
+}
+
+/* returns the output ifindex of the route, or -1 if it is not of interest */
+static int system_parse_route(struct nlmsghdr *nh, struct device_route *route)
+{
+	struct rtmsg *rtm = NLMSG_DATA(nh);
+	struct nlattr *nla[__RTA_MAX];
+	int alen;
+
+	if (rtm->rtm_family != AF_INET && rtm->rtm_family != AF_INET6)
+		return -1;
+
+	/* only routes of the kind installed by system_rt */
+	if (rtm->rtm_protocol != RTPROT_BOOT || rtm->rtm_type != RTN_UNICAST)
+		return -1;
+
+	nlmsg_parse(nh, sizeof(*rtm), nla, __RTA_MAX - 1, NULL);
+	if (!nla[RTA_OIF])
+		return -1;
+
+	alen = (rtm->rtm_family == AF_INET) ? 4 : 16;
+
+	memset(route, 0, sizeof(*route));
+	route->flags = (alen == 4) ? DEVADDR_INET4 : DEVADDR_INET6;
+	route->mask = rtm->rtm_dst_len;
+	route->table = nla[RTA_TABLE] ? nla_get_u32(nla[RTA_TABLE]) : rtm->rtm_table;
+	if (route->table == RT_TABLE_MAIN)
+		route->table = 0;
+
+	if (nla[RTA_DST] && nla_len(nla[RTA_DST]) == alen)
+		memcpy(&route->addr, nla_data(nla[RTA_DST]), alen);
+
+	if (nla[RTA_GATEWAY] && nla_len(nla[RTA_GATEWAY]) == alen)
+		memcpy(&route->nexthop, nla_data(nla[RTA_GATEWAY]), alen);
+
+	if (nla[RTA_PRIORITY])
+		route->metric = nla_get_u32(nla[RTA_PRIORITY]);
+
+	return nla_get_u32(nla[RTA_OIF]);
+}
+
+/* addresses and routes removed behind our back */
+static int cb_rtnl_repair_event(struct nl_msg *msg, void *arg)
+{
+	struct nlmsghdr *nh = nlmsg_hdr(msg);
+	struct device_addr addr;
+	struct device_route route;
+	int ifindex;
+
+	switch (nh->nlmsg_type) {
+	case RTM_NEWADDR:
+		ifindex = system_parse_addr(nh, &addr);
+		if (ifindex >= 0)
+			interface_ip_repair_addr_added(ifindex, &addr);
+		break;
+	case RTM_DELADDR:
+		ifindex = system_parse_addr(nh, &addr);
+		if (ifindex >= 0)
+			interface_ip_repair_addr(ifindex, &addr);
+		break;
+	case RTM_DELROUTE:
+		ifindex = system_parse_route(nh, &route);
+		if (ifindex >= 0)
+			interface_ip_repair_route(ifindex, &route);
+		break;
+	}
+
+	return NL_OK;
+}
+
+/* entries of an address or route dump */
+static int cb_rtnl_resync(struct nl_msg *msg, void *arg)
+{
+	struct nlmsghdr *nh = nlmsg_hdr(msg);
+	struct device_addr addr;
+	struct device_route route;
+	int ifindex;
+
+	switch (nh->nlmsg_type) {
+	case RTM_NEWADDR:
+		ifindex = system_parse_addr(nh, &addr);
+		if (ifindex >= 0)
+			interface_ip_resync_addr(ifindex, &addr);
+		break;
+	case RTM_NEWROUTE:
+		ifindex = system_parse_route(nh, &route);
+		if (ifindex >= 0)
+			interface_ip_resync_route(ifindex, &route);
+		break;
+	}
+
+	return NL_OK;
+}
+
+static int system_rtnl_dump(struct nl_sock *sock, struct nl_cb *cb, int type)
+{
+	struct rtgenmsg rtgen = {
+		.rtgen_family = AF_UNSPEC,
+	};
+	int ret;
+
+	ret = nl_send_simple(sock, type, NLM_F_DUMP, &rtgen, sizeof(rtgen));
+	if (ret < 0)
+		return ret;
+
+	return nl_recvmsgs(sock, cb);
+}
+
+/*
+ * Repair events were lost, compare the kernel state with the configured
+ * addresses and routes instead. The dump uses its own socket, so that it
+ * does not get mixed up with the acks of pending requests.
+ */
+static void system_resync_ip(void)
+{
+	struct nl_sock *sock;
+	struct nl_cb *cb;
+
+	D(SYSTEM, "Address/route events lost, resyncing with the kernel\n");
+
+	sock = create_socket(NETLINK_ROUTE, 0);
+	if (!sock)
+		return;
+
+	cb = nl_cb_alloc(NL_CB_DEFAULT);
+	if (!cb)
+		goto out;
+
+	nl_socket_set_buffer_size(sock, RTNL_RCVBUF_SIZE, 0);
+	nl_cb_set(cb, NL_CB_VALID, NL_CB_CUSTOM, cb_rtnl_resync, NULL);
+
+	interface_ip_resync_start();
+	if (system_rtnl_dump(sock, cb, RTM_GETADDR) < 0 ||
+	    system_rtnl_dump(sock, cb, RTM_GETROUTE) < 0) {
+		D(SYSTEM, "Failed to dump addresses and routes\n");
+		goto out_cb;
+	}
+
+	interface_ip_resync_complete();
+
+out_cb:
+	nl_cb_put(cb);
+out:
+	nl_socket_free(sock);
+}
+
+static void
+handler_repair_event(struct uloop_fd *u, unsigned int events)
+{
+	struct event_socket *ev = container_of(u, struct event_socket, uloop);
+
+	/* repairs triggered by the events go out in one batch */
+	system_batch_start();
+
+	/* ENOBUFS: the socket overflowed and events were dropped */
+	if (nl_recvmsgs(ev->sock, ev->cb) == -NLE_NOMEM)
+		system_resync_ip();
+
+	system_batch_end();
+}
+
 // Evaluate netlink messages
 static int cb_rtnl_event(struct nl_msg *msg, void *arg)
 {
@@ -254,33 +496,241 @@ handle_hotplug_event(struct uloop_fd *u, unsigned int events)
 	}
 }
 
+static int system_ioctl(unsigned long cmd, void *arg)
+{
+	netifd_stats.ioctls++;
+	return ioctl(sock_ioctl, cmd, arg);
+}
+
+static int system_rtnl_send(struct nl_msg *msg)
+{
+	netifd_stats.rtnl_requests++;
+	return nl_send_auto_complete(sock_rtnl, msg);
+}
+
+static int system_rtnl_wait(void)
+{
+	netifd_stats.rtnl_acks++;
+	return nl_wait_for_ack(sock_rtnl);
+}
+
+/*
+ * Requests issued inside a batch do not wait for their ack. The kernel has
+ * already processed a request by the time it is sent, so later requests and
+ * ioctls see its effect; acks are collected and errors reported when the
+ * outermost batch ends, before any request that needs a reply, or once
+ * RTNL_BATCH_MAX acks are outstanding, so they always fit into the receive
+ * buffer of the socket.
+ *
+ * A request can have a handler for the replies it gets, and one that is
+ * called with its result once the ack has arrived. Both run while the
+ * batch is flushed and must not issue requests themselves.
+ */
+struct rtnl_request {
+	int (*reply)(struct nl_msg *msg, void *arg);
+	void (*done)(int ret, void *arg);
+	void *arg;
+	int ret;
+};
+
+static int rtnl_batch;
+static int rtnl_pending;
+static struct rtnl_request rtnl_requests[RTNL_BATCH_MAX];
+
+/* drop whatever is left of the acks after the socket overflowed */
+static void system_rtnl_drain(void)
+{
+	char buf[4096];
+	int fd = nl_socket_get_fd(sock_rtnl);
+
+	while (recv(fd, buf, sizeof(buf), MSG_DONTWAIT) > 0);
+}
+
+static int cb_rtnl_request_reply(struct nl_msg *msg, void *arg)
+{
+	struct rtnl_request *req = arg;
+
+	if (!req->reply)
+		return NL_SKIP;
+
+	return req->reply(msg, req->arg);
+}
+
+static int cb_rtnl_request_ack(struct nl_msg *msg, void *arg)
+{
+	struct rtnl_request *req = arg;
+
+	req->ret = 0;
+	return NL_STOP;
+}
+
+static int
+cb_rtnl_request_error(struct sockaddr_nl *nla, struct nlmsgerr *err, void *arg)
+{
+	struct rtnl_request *req = arg;
+
+	req->ret = -nl_syserr2nlerr(err->error);
+	return NL_STOP;
+}
+
+/* receive the replies and the ack of the oldest outstanding request */
+static void system_rtnl_wait_request(struct rtnl_request *req)
+{
+	int ret;
+
+	netifd_stats.rtnl_acks++;
+	nl_cb_set(rtnl_cb, NL_CB_VALID, NL_CB_CUSTOM, cb_rtnl_request_reply, req);
+	nl_cb_set(rtnl_cb, NL_CB_ACK, NL_CB_CUSTOM, cb_rtnl_request_ack, req);
+	nl_cb_err(rtnl_cb, NL_CB_CUSTOM, cb_rtnl_request_error, req);
+
+	req->ret = 1;
+	while (req->ret > 0) {
+		ret = nl_recvmsgs(sock_rtnl, rtnl_cb);
+		if (ret < 0 && req->ret > 0)
+			req->ret = ret;
+	}
+}
+
+static void system_rtnl_flush(void)
+{
+	struct rtnl_request *req;
+	bool lost = false;
+	int i, n;
+
+	n = rtnl_pending;
+	rtnl_pending = 0;
+
+	for (i = 0; i < n; i++) {
+		req = &rtnl_requests[i];
+
+		/* ENOBUFS: acks were dropped, waiting for them would block */
+		if (lost)
+			req->ret = -NLE_NOMEM;
+		else
+			system_rtnl_wait_request(req);
+
+		if (req->ret == -NLE_NOMEM && !lost) {
+			lost = true;
+			system_rtnl_drain();
+		}
+
+		if (req->done) {
+			req->done(req->ret, req->arg);
+			continue;
+		}
+
+		if (!req->ret)
+			continue;
+
+		netifd_stats.rtnl_batch_errors++;
+		D(SYSTEM, "Batched netlink request failed: %s\n", nl_geterror(req->ret));
+	}
+}
+
+void system_batch_start(void)
+{
+	rtnl_batch++;
+}
+
+void system_batch_end(void)
+{
+	if (--rtnl_batch > 0)
+		return;
+
+	rtnl_batch = 0;
+	system_rtnl_flush();
+}
+
 static int system_rtnl_call(struct nl_msg *msg)
 {
 	int ret;
 
-	ret = nl_send_auto_complete(sock_rtnl, msg);
+	system_rtnl_flush();
+	ret = system_rtnl_send(msg);
 	nlmsg_free(msg);
 
 	if (ret < 0)
 		return ret;
 
-	return nl_wait_for_ack(sock_rtnl);
+	return system_rtnl_wait();
+}
+
+/*
+ * Send a request with handlers for its replies and its result. Outside of
+ * a batch the request completes before this returns, with its result as
+ * the return value. Inside a batch this returns 0 as soon as the request
+ * is sent.
+ */
+static int
+system_rtnl_request(struct nl_msg *msg,
+		    int (*reply)(struct nl_msg *msg, void *arg),
+		    void (*done)(int ret, void *arg), void *arg)
+{
+	struct rtnl_request *req;
+	int ret;
+
+	ret = system_rtnl_send(msg);
+	nlmsg_free(msg);
+
+	if (ret < 0) {
+		if (done)
+			done(ret, arg);
+		return ret;
+	}
+
+	req = &rtnl_requests[rtnl_pending++];
+	req->reply = reply;
+	req->done = done;
+	req->arg = arg;
+
+	if (!rtnl_batch) {
+		system_rtnl_flush();
+		return req->ret;
+	}
+
+	if (rtnl_pending >= RTNL_BATCH_MAX)
+		system_rtnl_flush();
+
+	return 0;
+}
+
+/*
+ * For requests whose result is not needed by the caller: inside a batch
+ * this returns 0 as soon as the request is sent, errors only show up in
+ * the log and the stats. Use system_rtnl_call() if the caller checks it.
+ */
+static int system_rtnl_call_batch(struct nl_msg *msg)
+{
+	return system_rtnl_request(msg, NULL, NULL, NULL);
+}
+
+/*
+ * Link lookups of a batch are collected with its other replies, the ifindex
+ * of a device is -1 until then. Requests that need it flush the batch
+ * first, so a whole layer of devices is looked up in one pass.
+ */
+static int system_if_index(struct device *dev)
+{
+	if (dev->ifindex < 0)
+		system_rtnl_flush();
+
+	return dev->ifindex;
 }
 
 int system_bridge_delbr(struct device *bridge)
 {
-	return ioctl(sock_ioctl, SIOCBRDELBR, bridge->ifname);
+	return system_ioctl(SIOCBRDELBR, bridge->ifname);
 }
 
 static int system_bridge_if(const char *bridge, struct device *dev, int cmd, void *data)
 {
 	struct ifreq ifr;
 	if (dev)
-		ifr.ifr_ifindex = dev->ifindex;
+		ifr.ifr_ifindex = system_if_index(dev);
 	else
 		ifr.ifr_data = data;
 	strncpy(ifr.ifr_name, bridge, sizeof(ifr.ifr_name));
-	return ioctl(sock_ioctl, cmd, &ifr);
+	return system_ioctl(cmd, &ifr);
 }
 
 static bool system_is_bridge(const char *name, char *buf, int buflen)
@@ -341,7 +791,7 @@ static int system_if_resolve(struct device *dev)
 {
 	struct ifreq ifr;
 	strncpy(ifr.ifr_name, dev->ifname, sizeof(ifr.ifr_name));
-	if (!ioctl(sock_ioctl, SIOCGIFINDEX, &ifr))
+	if (!system_ioctl(SIOCGIFINDEX, &ifr))
 		return ifr.ifr_ifindex;
 	else
 		return 0;
@@ -351,10 +801,10 @@ static int system_if_flags(const char *ifname, unsigned add, unsigned rem)
 {
 	struct ifreq ifr;
 	strncpy(ifr.ifr_name, ifname, sizeof(ifr.ifr_name));
-	ioctl(sock_ioctl, SIOCGIFFLAGS, &ifr);
+	system_ioctl(SIOCGIFFLAGS, &ifr);
 	ifr.ifr_flags |= add;
 	ifr.ifr_flags &= ~rem;
-	return ioctl(sock_ioctl, SIOCSIFFLAGS, &ifr);
+	return system_ioctl(SIOCSIFFLAGS, &ifr);
 }
 
 struct clear_data {
@@ -421,8 +871,8 @@ static int cb_clear_event(struct nl_msg *msg, void *arg)
 	hdr->nlmsg_type = type;
 	hdr->nlmsg_flags = NLM_F_REQUEST;
 
-	if (!nl_send_auto_complete(sock_rtnl, clr->msg))
-		nl_wait_for_ack(sock_rtnl);
+	if (!system_rtnl_send(clr->msg))
+		system_rtnl_wait();
 
 	return NL_SKIP;
 }
@@ -481,7 +931,8 @@ system_if_clear_entries(struct device *dev, int type, int af)
 	nl_cb_set(cb, NL_CB_FINISH, NL_CB_CUSTOM, cb_finish_event, &pending);
 	nl_cb_err(cb, NL_CB_CUSTOM, error_handler, &pending);
 
-	nl_send_auto_complete(sock_rtnl, clr.msg);
+	system_rtnl_flush();
+	system_rtnl_send(clr.msg);
 	while (pending > 0)
 		nl_recvmsgs(sock_rtnl, cb);
 
@@ -536,7 +987,7 @@ int system_bridge_addbr(struct device *bridge, struct bridge_config *cfg)
 {
 	unsigned long args[4] = {};
 
-	if (ioctl(sock_ioctl, SIOCBRADDBR, bridge->ifname) < 0)
+	if (system_ioctl(SIOCBRADDBR, bridge->ifname) < 0)
 		return -1;
 
 	args[0] = BRCTL_SET_BRIDGE_STP_STATE;
@@ -550,6 +1001,14 @@ int system_bridge_addbr(struct device *bridge, struct bridge_config *cfg)
 	system_set_dev_sysctl("/sys/devices/virtual/net/%s/bridge/multicast_snooping",
 		bridge->ifname, cfg->igmp_snoop ? "1" : "0");
 
+	if (cfg->vlan_filtering) {
+		/* only the configured VLANs get added to the ports */
+		system_set_dev_sysctl("/sys/devices/virtual/net/%s/bridge/default_pvid",
+			bridge->ifname, "0");
+		system_set_dev_sysctl("/sys/devices/virtual/net/%s/bridge/vlan_filtering",
+			bridge->ifname, "1");
+	}
+
 	if (cfg->flags & BRIDGE_OPT_AGEING_TIME) {
 		args[0] = BRCTL_SET_AGEING_TIME;
 		args[1] = sec_to_jiffies(cfg->ageing_time);
@@ -571,99 +1030,433 @@ int system_bridge_addbr(struct device *bridge, struct bridge_config *cfg)
 	return 0;
 }
 
-static int system_vlan(struct device *dev, int id)
+#ifndef BRIDGE_VLAN_INFO_RANGE_BEGIN
+#define BRIDGE_VLAN_INFO_RANGE_BEGIN	(1 << 3)
+#define BRIDGE_VLAN_INFO_RANGE_END	(1 << 4)
+#endif
+
+int system_bridge_vlan(struct device *dev, struct bridge_vlan_range *r, int n,
+		       bool add, bool self)
 {
-	struct vlan_ioctl_args ifr = {
-		.cmd = SET_VLAN_NAME_TYPE_CMD,
-		.u.name_type = VLAN_NAME_TYPE_RAW_PLUS_VID_NO_PAD,
-	};
+	struct ifinfomsg ifi = { .ifi_family = AF_BRIDGE, };
+	struct bridge_vlan_info vinfo;
+	struct nlattr *spec;
+	struct nl_msg *msg;
+	int i;
 
-	ioctl(sock_ioctl, SIOCSIFVLAN, &ifr);
+	if (!n)
+		return 0;
 
-	if (id < 0) {
-		ifr.cmd = DEL_VLAN_CMD;
-		ifr.u.VID = 0;
-	} else {
-		ifr.cmd = ADD_VLAN_CMD;
-		ifr.u.VID = id;
-	}
-	strncpy(ifr.device1, dev->ifname, sizeof(ifr.device1));
-	return ioctl(sock_ioctl, SIOCSIFVLAN, &ifr);
-}
+	ifi.ifi_index = system_if_resolve(dev);
+	if (!ifi.ifi_index)
+		return -1;
 
-int system_vlan_add(struct device *dev, int id)
-{
-	return system_vlan(dev, id);
-}
+	msg = nlmsg_alloc_simple(add ? RTM_SETLINK : RTM_DELLINK, NLM_F_REQUEST);
+	if (!msg)
+		return -1;
 
-int system_vlan_del(struct device *dev)
-{
-	return system_vlan(dev, -1);
-}
+	nlmsg_append(msg, &ifi, sizeof(ifi), 0);
 
-static void
-system_if_get_settings(struct device *dev, struct device_settings *s)
-{
-	struct ifreq ifr;
+	/* all ranges of the port go out in a single request */
+	spec = nla_nest_start(msg, IFLA_AF_SPEC);
+	if (self)
+		nla_put_u16(msg, IFLA_BRIDGE_FLAGS, BRIDGE_FLAGS_SELF);
 
-	memset(&ifr, 0, sizeof(ifr));
-	strncpy(ifr.ifr_name, dev->ifname, sizeof(ifr.ifr_name));
+	for (i = 0; i < n; i++) {
+		memset(&vinfo, 0, sizeof(vinfo));
+		vinfo.vid = r[i].vid;
+		if (r[i].flags & BRVLAN_F_PVID)
+			vinfo.flags |= BRIDGE_VLAN_INFO_PVID;
+		if (r[i].flags & BRVLAN_F_UNTAGGED)
+			vinfo.flags |= BRIDGE_VLAN_INFO_UNTAGGED;
 
-	if (ioctl(sock_ioctl, SIOCGIFMTU, &ifr) == 0) {
-		s->mtu = ifr.ifr_mtu;
-		s->flags |= DEV_OPT_MTU;
-	}
+		if (r[i].vid_end > r[i].vid) {
+			vinfo.flags |= BRIDGE_VLAN_INFO_RANGE_BEGIN;
+			nla_put(msg, IFLA_BRIDGE_VLAN_INFO, sizeof(vinfo), &vinfo);
 
-	if (ioctl(sock_ioctl, SIOCGIFTXQLEN, &ifr) == 0) {
-		s->txqueuelen = ifr.ifr_qlen;
-		s->flags |= DEV_OPT_TXQUEUELEN;
+			vinfo.flags &= ~BRIDGE_VLAN_INFO_RANGE_BEGIN;
+			vinfo.flags |= BRIDGE_VLAN_INFO_RANGE_END;
+			vinfo.vid = r[i].vid_end;
+		}
+		nla_put(msg, IFLA_BRIDGE_VLAN_INFO, sizeof(vinfo), &vinfo);
 	}
+	nla_nest_end(msg, spec);
 
-	if (ioctl(sock_ioctl, SIOCGIFHWADDR, &ifr) == 0) {
-		memcpy(s->macaddr, &ifr.ifr_hwaddr.sa_data, sizeof(s->macaddr));
-		s->flags |= DEV_OPT_MACADDR;
-	}
+	return system_rtnl_call_batch(msg);
 }
 
-static void
-system_if_apply_settings(struct device *dev, struct device_settings *s)
+static struct nl_msg *
+system_link_msg(int cmd, int flags, const char *ifname,
+		unsigned int ifi_flags, unsigned int ifi_change)
 {
-	struct ifreq ifr;
+	struct ifinfomsg ifi = {
+		.ifi_family = AF_UNSPEC,
+		.ifi_flags = ifi_flags,
+		.ifi_change = ifi_change,
+	};
+	struct nl_msg *msg;
 
-	memset(&ifr, 0, sizeof(ifr));
-	strncpy(ifr.ifr_name, dev->ifname, sizeof(ifr.ifr_name));
-	if (s->flags & DEV_OPT_MTU) {
-		ifr.ifr_mtu = s->mtu;
-		if (ioctl(sock_ioctl, SIOCSIFMTU, &ifr) < 0)
+	msg = nlmsg_alloc_simple(cmd, NLM_F_REQUEST | flags);
+	if (!msg)
+		return NULL;
+
+	nlmsg_append(msg, &ifi, sizeof(ifi), 0);
+	nla_put_string(msg, IFLA_IFNAME, ifname);
+	return msg;
+}
+
+static void
+system_link_put_settings(struct nl_msg *msg, struct device_settings *s)
+{
+	if (s->flags & DEV_OPT_MTU)
+		nla_put_u32(msg, IFLA_MTU, s->mtu);
+	if (s->flags & DEV_OPT_TXQUEUELEN)
+		nla_put_u32(msg, IFLA_TXQLEN, s->txqueuelen);
+	if (s->flags & DEV_OPT_MACADDR)
+		nla_put(msg, IFLA_ADDRESS, sizeof(s->macaddr), s->macaddr);
+}
+
+/*
+ * Create a link of the given kind with its initial settings in a single
+ * request and bring it up. The link is deleted again with the device, so
+ * there are no original settings to restore.
+ */
+static int
+system_link_add(struct device *dev, struct nl_msg *msg)
+{
+	int ret;
+
+	ret = system_rtnl_call(msg);
+	if (ret)
+		return ret;
+
+	dev->orig_settings.flags = 0;
+	dev->ifindex = system_if_resolve(dev);
+	return 0;
+}
+
+static int system_link_del(const char *ifname)
+{
+	struct nl_msg *msg;
+
+	msg = system_link_msg(RTM_DELLINK, 0, ifname, 0, 0);
+	if (!msg)
+		return -1;
+
+	return system_rtnl_call(msg);
+}
+
+static int system_vlan(struct device *dev, int id)
+{
+	struct vlan_ioctl_args ifr = {
+		.cmd = SET_VLAN_NAME_TYPE_CMD,
+		.u.name_type = VLAN_NAME_TYPE_RAW_PLUS_VID_NO_PAD,
+	};
+
+	system_ioctl(SIOCSIFVLAN, &ifr);
+
+	if (id < 0) {
+		ifr.cmd = DEL_VLAN_CMD;
+		ifr.u.VID = 0;
+	} else {
+		ifr.cmd = ADD_VLAN_CMD;
+		ifr.u.VID = id;
+	}
+	strncpy(ifr.device1, dev->ifname, sizeof(ifr.device1));
+	return system_ioctl(SIOCSIFVLAN, &ifr);
+}
+
+struct system_vlan_req {
+	struct device *dev;
+	struct device *parent;
+	int id;
+};
+
+static void system_vlan_add_done(int ret, void *arg)
+{
+	struct system_vlan_req *req = arg;
+
+	/* kernels without rtnl_link support for vlans */
+	if (ret) {
+		system_vlan(req->parent, req->id);
+		system_if_up_ioctl(req->dev);
+	}
+
+	free(req);
+}
+
+/*
+ * Inside a batch the link is created without waiting for the ack; its
+ * ifindex is looked up with the next reply pass of the batch.
+ */
+int system_vlan_add(struct device *dev, struct device *parent, int id)
+{
+	struct system_vlan_req *req;
+	struct nlattr *linkinfo, *data;
+	struct nl_msg *msg;
+
+	if (system_if_index(parent) <= 0)
+		goto fallback;
+
+	msg = system_link_msg(RTM_NEWLINK, NLM_F_CREATE | NLM_F_EXCL,
+			      dev->ifname, IFF_UP, IFF_UP);
+	if (!msg)
+		goto fallback;
+
+	nla_put_u32(msg, IFLA_LINK, parent->ifindex);
+	system_link_put_settings(msg, &dev->settings);
+
+	linkinfo = nla_nest_start(msg, IFLA_LINKINFO);
+	nla_put_string(msg, IFLA_INFO_KIND, "vlan");
+	data = nla_nest_start(msg, IFLA_INFO_DATA);
+	nla_put_u16(msg, IFLA_VLAN_ID, id);
+	nla_nest_end(msg, data);
+	nla_nest_end(msg, linkinfo);
+
+	req = calloc(1, sizeof(*req));
+	if (!req) {
+		nlmsg_free(msg);
+		goto fallback;
+	}
+
+	req->dev = dev;
+	req->parent = parent;
+	req->id = id;
+
+	dev->orig_settings.flags = 0;
+	system_rtnl_request(msg, NULL, system_vlan_add_done, req);
+	system_if_get_link(dev, false);
+	return 0;
+
+fallback:
+	/* kernels without rtnl_link support for vlans */
+	system_vlan(parent, id);
+	return system_if_up(dev);
+}
+
+int system_vlan_del(struct device *dev)
+{
+	if (!system_link_del(dev->ifname))
+		return 0;
+
+	return system_vlan(dev, -1);
+}
+
+static void
+system_if_get_settings(struct device *dev, struct device_settings *s)
+{
+	struct ifreq ifr;
+
+	memset(&ifr, 0, sizeof(ifr));
+	strncpy(ifr.ifr_name, dev->ifname, sizeof(ifr.ifr_name));
+
+	if (system_ioctl(SIOCGIFMTU, &ifr) == 0) {
+		s->mtu = ifr.ifr_mtu;
+		s->flags |= DEV_OPT_MTU;
+	}
+
+	if (system_ioctl(SIOCGIFTXQLEN, &ifr) == 0) {
+		s->txqueuelen = ifr.ifr_qlen;
+		s->flags |= DEV_OPT_TXQUEUELEN;
+	}
+
+	if (system_ioctl(SIOCGIFHWADDR, &ifr) == 0) {
+		memcpy(s->macaddr, &ifr.ifr_hwaddr.sa_data, sizeof(s->macaddr));
+		s->flags |= DEV_OPT_MACADDR;
+	}
+}
+
+static void
+system_if_apply_settings(struct device *dev, struct device_settings *s)
+{
+	struct ifreq ifr;
+
+	memset(&ifr, 0, sizeof(ifr));
+	strncpy(ifr.ifr_name, dev->ifname, sizeof(ifr.ifr_name));
+	if (s->flags & DEV_OPT_MTU) {
+		ifr.ifr_mtu = s->mtu;
+		if (system_ioctl(SIOCSIFMTU, &ifr) < 0)
 			s->flags &= ~DEV_OPT_MTU;
 	}
 	if (s->flags & DEV_OPT_TXQUEUELEN) {
 		ifr.ifr_qlen = s->txqueuelen;
-		if (ioctl(sock_ioctl, SIOCSIFTXQLEN, &ifr) < 0)
+		if (system_ioctl(SIOCSIFTXQLEN, &ifr) < 0)
 			s->flags &= ~DEV_OPT_TXQUEUELEN;
 	}
 	if (s->flags & DEV_OPT_MACADDR) {
 		ifr.ifr_hwaddr.sa_family = ARPHRD_ETHER;
 		memcpy(&ifr.ifr_hwaddr.sa_data, s->macaddr, sizeof(s->macaddr));
-		if (ioctl(sock_ioctl, SIOCSIFHWADDR, &ifr) < 0)
+		if (system_ioctl(SIOCSIFHWADDR, &ifr) < 0)
 			s->flags &= ~DEV_OPT_MACADDR;
 	}
 }
 
-int system_if_up(struct device *dev)
+static int cb_get_link(struct nl_msg *msg, void *arg)
 {
+	struct nlmsghdr *nh = nlmsg_hdr(msg);
+	struct ifinfomsg *ifi = NLMSG_DATA(nh);
+	struct nlattr *nla[__IFLA_MAX];
+	struct device *dev = arg;
+	struct device_settings *s = &dev->orig_settings;
+
+	if (nh->nlmsg_type != RTM_NEWLINK)
+		return NL_SKIP;
+
+	nlmsg_parse(nh, sizeof(*ifi), nla, __IFLA_MAX - 1, NULL);
+
+	dev->ifindex = ifi->ifi_index;
+	s->flags = 0;
+	if (nla[IFLA_MTU]) {
+		s->mtu = nla_get_u32(nla[IFLA_MTU]);
+		s->flags |= DEV_OPT_MTU;
+	}
+	if (nla[IFLA_TXQLEN]) {
+		s->txqueuelen = nla_get_u32(nla[IFLA_TXQLEN]);
+		s->flags |= DEV_OPT_TXQUEUELEN;
+	}
+	if (nla[IFLA_ADDRESS] && nla_len(nla[IFLA_ADDRESS]) == sizeof(s->macaddr)) {
+		memcpy(s->macaddr, nla_data(nla[IFLA_ADDRESS]), sizeof(s->macaddr));
+		s->flags |= DEV_OPT_MACADDR;
+	}
+
+	return NL_OK;
+}
+
+static int cb_get_ifindex(struct nl_msg *msg, void *arg)
+{
+	struct nlmsghdr *nh = nlmsg_hdr(msg);
+	struct ifinfomsg *ifi = NLMSG_DATA(nh);
+	struct device *dev = arg;
+
+	if (nh->nlmsg_type != RTM_NEWLINK)
+		return NL_SKIP;
+
+	dev->ifindex = ifi->ifi_index;
+	return NL_OK;
+}
+
+static void system_if_get_index_done(int ret, void *arg)
+{
+	struct device *dev = arg;
+
+	if (dev->ifindex < 0)
+		dev->ifindex = system_if_resolve(dev);
+}
+
+static void system_if_get_link_done(int ret, void *arg)
+{
+	struct device *dev = arg;
+
+	if (dev->ifindex >= 0)
+		return;
+
+	/* kernels that cannot look up links by name */
 	system_if_get_settings(dev, &dev->orig_settings);
-	system_if_apply_settings(dev, &dev->settings);
 	dev->ifindex = system_if_resolve(dev);
+}
+
+/*
+ * Fetch the ifindex, and the original settings if asked for, of a device
+ * with a single RTM_GETLINK request. The kernel answers it as it is sent,
+ * so requests sent after it in the same batch do not change the reply.
+ */
+static void system_if_get_link(struct device *dev, bool settings)
+{
+	void (*done)(int ret, void *arg);
+	struct nl_msg *msg;
+
+	done = settings ? system_if_get_link_done : system_if_get_index_done;
+	dev->ifindex = -1;
+
+	msg = system_link_msg(RTM_GETLINK, 0, dev->ifname, 0, 0);
+	if (!msg) {
+		done(-1, dev);
+		return;
+	}
+
+	system_rtnl_request(msg, settings ? cb_get_link : cb_get_ifindex,
+			    done, dev);
+}
+
+/*
+ * Write settings and link state of a device with a single RTM_NEWLINK
+ * request
+ */
+static int
+system_if_set_link(struct device *dev, struct device_settings *s, bool up)
+{
+	struct nl_msg *msg;
+
+	msg = system_link_msg(RTM_NEWLINK, 0, dev->ifname,
+			      up ? IFF_UP : 0, IFF_UP);
+	if (!msg)
+		return -1;
+
+	system_link_put_settings(msg, s);
+	return system_rtnl_call(msg);
+}
+
+static int system_if_up_ioctl(struct device *dev)
+{
+	system_if_apply_settings(dev, &dev->settings);
 	return system_if_flags(dev->ifname, IFF_UP, 0);
 }
 
+static void system_if_up_done(int ret, void *arg)
+{
+	if (ret)
+		system_if_up_ioctl(arg);
+}
+
+/*
+ * Inside a batch neither the lookup nor the request bringing the link up
+ * wait for their replies; failures fall back to ioctls once they arrive.
+ */
+int system_if_up(struct device *dev)
+{
+	struct nl_msg *msg;
+
+	system_if_get_link(dev, true);
+
+	msg = system_link_msg(RTM_NEWLINK, 0, dev->ifname, IFF_UP, IFF_UP);
+	if (!msg)
+		return system_if_up_ioctl(dev);
+
+	system_link_put_settings(msg, &dev->settings);
+	system_rtnl_request(msg, NULL, system_if_up_done, dev);
+	return 0;
+}
+
 int system_if_down(struct device *dev)
 {
-	int ret = system_if_flags(dev->ifname, 0, IFF_UP);
+	struct device_settings s;
+	int ret;
+
+	/* the original settings arrive with the lookup of system_if_up */
+	system_if_index(dev);
 	dev->orig_settings.flags &= dev->settings.flags;
-	system_if_apply_settings(dev, &dev->orig_settings);
-	return ret;
+	s = dev->orig_settings;
+
+	/*
+	 * The kernel applies IFLA_ADDRESS before the link flags, which fails
+	 * on drivers that cannot change the MAC address of a running device.
+	 * Restore the address with a second request once the link is down.
+	 */
+	s.flags &= ~DEV_OPT_MACADDR;
+	if (system_if_set_link(dev, &s, false)) {
+		ret = system_if_flags(dev->ifname, 0, IFF_UP);
+		system_if_apply_settings(dev, &dev->orig_settings);
+		return ret;
+	}
+
+	if (!(dev->orig_settings.flags & DEV_OPT_MACADDR))
+		return 0;
+
+	s.flags = DEV_OPT_MACADDR;
+	if (system_if_set_link(dev, &s, false))
+		system_if_apply_settings(dev, &s);
+
+	return 0;
 }
 
 int system_if_check(struct device *dev)
@@ -680,6 +1473,7 @@ system_if_get_parent(struct device *dev)
 	FILE *f;
 
 	snprintf(buf, sizeof(buf), "/sys/class/net/%s/iflink", dev->ifname);
+	netifd_stats.sysfs_opens++;
 	f = fopen(buf, "r");
 	if (!f)
 		return NULL;
@@ -710,6 +1504,7 @@ read_string_file(int dir_fd, const char *file, char *buf, int len)
 	char *c;
 	int fd;
 
+	netifd_stats.sysfs_opens++;
 	fd = openat(dir_fd, file, O_RDONLY);
 	if (fd < 0)
 		return false;
@@ -789,6 +1584,7 @@ system_if_dump_info(struct device *dev, struct blob_buf *b)
 	int dir_fd, val = 0;
 
 	snprintf(buf, sizeof(buf), "/sys/class/net/%s", dev->ifname);
+	netifd_stats.sysfs_opens++;
 	dir_fd = open(buf, O_DIRECTORY);
 
 	if (read_int_file(dir_fd, "carrier", &val))
@@ -800,7 +1596,7 @@ system_if_dump_info(struct device *dev, struct blob_buf *b)
 	ifr.ifr_data = (caddr_t) &ecmd;
 	ecmd.cmd = ETHTOOL_GSET;
 
-	if (ioctl(sock_ioctl, SIOCETHTOOL, &ifr) == 0) {
+	if (system_ioctl(SIOCETHTOOL, &ifr) == 0) {
 		c = blobmsg_open_array(b, "link-advertising");
 		system_add_link_modes(b, ecmd.advertising);
 		blobmsg_close_array(b, c);
@@ -837,6 +1633,7 @@ system_if_dump_stats(struct device *dev, struct blob_buf *b)
 	int i, val = 0;
 
 	snprintf(buf, sizeof(buf), "/sys/class/net/%s/statistics", dev->ifname);
+	netifd_stats.sysfs_opens++;
 	stats_dir = open(buf, O_DIRECTORY);
 	if (stats_dir < 0)
 		return -1;
@@ -849,21 +1646,37 @@ system_if_dump_stats(struct device *dev, struct blob_buf *b)
 	return 0;
 }
 
-static int system_addr(struct device *dev, struct device_addr *addr, int cmd)
+static bool system_kernel_version_ge(int major, int minor)
+{
+	static int kmajor = -1, kminor;
+	struct utsname un;
+
+	if (kmajor < 0) {
+		kmajor = 0;
+		if (!uname(&un))
+			sscanf(un.release, "%d.%d", &kmajor, &kminor);
+	}
+
+	return kmajor > major || (kmajor == major && kminor >= minor);
+}
+
+static struct nl_msg *
+system_addr_msg(struct device *dev, struct device_addr *addr, int cmd,
+		unsigned int flags)
 {
 	bool v4 = ((addr->flags & DEVADDR_FAMILY) == DEVADDR_INET4);
 	int alen = v4 ? 4 : 16;
 	struct ifaddrmsg ifa = {
 		.ifa_family = (alen == 4) ? AF_INET : AF_INET6,
 		.ifa_prefixlen = addr->mask,
-		.ifa_index = dev->ifindex,
+		.ifa_index = system_if_index(dev),
 	};
 
 	struct nl_msg *msg;
 
 	msg = nlmsg_alloc_simple(cmd, 0);
 	if (!msg)
-		return -1;
+		return NULL;
 
 	nlmsg_append(msg, &ifa, sizeof(ifa), 0);
 	nla_put(msg, IFA_LOCAL, alen, &addr->addr);
@@ -874,7 +1687,21 @@ static int system_addr(struct device *dev, struct device_addr *addr, int cmd)
 			nla_put_u32(msg, IFA_ADDRESS, addr->point_to_point);
 	}
 
-	return system_rtnl_call(msg);
+	if (flags)
+		nla_put_u32(msg, IFA_FLAGS, flags);
+
+	return msg;
+}
+
+static int system_addr(struct device *dev, struct device_addr *addr, int cmd)
+{
+	struct nl_msg *msg;
+
+	msg = system_addr_msg(dev, addr, cmd, 0);
+	if (!msg)
+		return -1;
+
+	return system_rtnl_call_batch(msg);
 }
 
 int system_add_address(struct device *dev, struct device_addr *addr)
@@ -882,45 +1709,99 @@ int system_add_address(struct device *dev, struct device_addr *addr)
 	return system_addr(dev, addr, RTM_NEWADDR);
 }
 
+/*
+ * Add an address without the prefix route the kernel creates for it.
+ * Older kernels silently ignore the flag, so support is derived from the
+ * kernel version: 3.14 for IPv6, 4.4 for IPv4. The request is not batched,
+ * the caller falls back to the plain add if it fails.
+ */
+int system_add_address_noprefixroute(struct device *dev, struct device_addr *addr)
+{
+	bool v4 = ((addr->flags & DEVADDR_FAMILY) == DEVADDR_INET4);
+	struct nl_msg *msg;
+
+	if (!system_kernel_version_ge(v4 ? 4 : 3, v4 ? 4 : 14))
+		return -EOPNOTSUPP;
+
+	msg = system_addr_msg(dev, addr, RTM_NEWADDR, IFA_F_NOPREFIXROUTE);
+	if (!msg)
+		return -1;
+
+	return system_rtnl_call(msg);
+}
+
+/* EEXIST: the entry was not missing, so nothing was repaired */
+static void system_count_restore(int ret, void *arg)
+{
+	unsigned int *count = arg;
+
+	if (!ret)
+		(*count)++;
+}
+
+/*
+ * Add an address only if it is missing, like system_restore_route. Without
+ * NLM_F_REPLACE the kernel refuses to add an existing address.
+ */
+int system_restore_address(struct device *dev, struct device_addr *addr,
+			   bool noprefixroute)
+{
+	bool v4 = ((addr->flags & DEVADDR_FAMILY) == DEVADDR_INET4);
+	struct nl_msg *msg;
+
+	if (noprefixroute && !system_kernel_version_ge(v4 ? 4 : 3, v4 ? 4 : 14))
+		return -EOPNOTSUPP;
+
+	msg = system_addr_msg(dev, addr, RTM_NEWADDR,
+			      noprefixroute ? IFA_F_NOPREFIXROUTE : 0);
+	if (!msg)
+		return -1;
+
+	return system_rtnl_request(msg, NULL, system_count_restore,
+				   &netifd_stats.addr_repairs);
+}
+
 int system_del_address(struct device *dev, struct device_addr *addr)
 {
 	return system_addr(dev, addr, RTM_DELADDR);
 }
 
-static int system_rt(struct device *dev, struct device_route *route, int cmd)
+static bool system_rt_have_gw(union if_addr *gw, int alen)
 {
-	int alen = ((route->flags & DEVADDR_FAMILY) == DEVADDR_INET4) ? 4 : 16;
-	bool have_gw;
-	unsigned int flags = 0;
-	int ifindex = dev->ifindex;
-
 	if (alen == 4)
-		have_gw = !!route->nexthop.in.s_addr;
-	else
-		have_gw = route->nexthop.in6.s6_addr32[0] ||
-			route->nexthop.in6.s6_addr32[1] ||
-			route->nexthop.in6.s6_addr32[2] ||
-			route->nexthop.in6.s6_addr32[3];
+		return !!gw->in.s_addr;
+
+	return gw->in6.s6_addr32[0] || gw->in6.s6_addr32[1] ||
+		gw->in6.s6_addr32[2] || gw->in6.s6_addr32[3];
+}
+
+static struct nl_msg *
+system_rt_msg(struct device *dev, struct device_route *route, int cmd,
+	      unsigned int flags)
+{
+	int alen = ((route->flags & DEVADDR_FAMILY) == DEVADDR_INET4) ? 4 : 16;
+	bool have_gw = system_rt_have_gw(&route->nexthop, alen);
+	unsigned int table = route->table ? route->table : RT_TABLE_MAIN;
+	bool unreachable = !!(route->flags & DEVROUTE_UNREACHABLE);
+	int ifindex = dev ? system_if_index(dev) : 0;
 
 	unsigned char scope = (cmd == RTM_DELROUTE) ? RT_SCOPE_NOWHERE :
-			(have_gw) ? RT_SCOPE_UNIVERSE : RT_SCOPE_LINK;
+			(have_gw || unreachable) ? RT_SCOPE_UNIVERSE : RT_SCOPE_LINK;
 
 	struct rtmsg rtm = {
 		.rtm_family = (alen == 4) ? AF_INET : AF_INET6,
 		.rtm_dst_len = route->mask,
-		.rtm_table = RT_TABLE_MAIN,
+		.rtm_table = (table < 256) ? table : RT_TABLE_UNSPEC,
 		.rtm_protocol = (route->flags & DEVADDR_KERNEL) ? RTPROT_KERNEL : RTPROT_BOOT,
 		.rtm_scope = scope,
-		.rtm_type = (cmd == RTM_DELROUTE) ? 0: RTN_UNICAST,
+		.rtm_type = (cmd == RTM_DELROUTE) ? 0 :
+			unreachable ? RTN_UNREACHABLE : RTN_UNICAST,
 	};
 	struct nl_msg *msg;
 
-	if (cmd == RTM_NEWROUTE)
-		flags |= NLM_F_CREATE | NLM_F_REPLACE;
-
 	msg = nlmsg_alloc_simple(cmd, flags);
 	if (!msg)
-		return -1;
+		return NULL;
 
 	nlmsg_append(msg, &rtm, sizeof(rtm), 0);
 
@@ -933,9 +1814,25 @@ static int system_rt(struct device *dev, struct device_route *route, int cmd)
 	if (have_gw)
 		nla_put(msg, RTA_GATEWAY, alen, &route->nexthop);
 
-	nla_put_u32(msg, RTA_OIF, ifindex);
+	if (ifindex)
+		nla_put_u32(msg, RTA_OIF, ifindex);
 
-	return system_rtnl_call(msg);
+	if (table >= 256)
+		nla_put_u32(msg, RTA_TABLE, table);
+
+	return msg;
+}
+
+static int system_rt(struct device *dev, struct device_route *route, int cmd)
+{
+	struct nl_msg *msg;
+
+	msg = system_rt_msg(dev, route, cmd,
+			    (cmd == RTM_NEWROUTE) ? NLM_F_CREATE | NLM_F_REPLACE : 0);
+	if (!msg)
+		return -1;
+
+	return system_rtnl_call_batch(msg);
 }
 
 int system_add_route(struct device *dev, struct device_route *route)
@@ -943,11 +1840,272 @@ int system_add_route(struct device *dev, struct device_route *route)
 	return system_rt(dev, route, RTM_NEWROUTE);
 }
 
+/*
+ * Add a route only if it is missing. The request is batched, the repair is
+ * counted once its ack shows that the route was actually added.
+ */
+int system_restore_route(struct device *dev, struct device_route *route)
+{
+	struct nl_msg *msg;
+
+	msg = system_rt_msg(dev, route, RTM_NEWROUTE, NLM_F_CREATE | NLM_F_EXCL);
+	if (!msg)
+		return -1;
+
+	return system_rtnl_request(msg, NULL, system_count_restore,
+				   &netifd_stats.route_repairs);
+}
+
 int system_del_route(struct device *dev, struct device_route *route)
 {
 	return system_rt(dev, route, RTM_DELROUTE);
 }
 
+static int system_mp_rt(struct device_mp_route *route, int cmd)
+{
+	int alen = ((route->flags & DEVADDR_FAMILY) == DEVADDR_INET4) ? 4 : 16;
+	unsigned int table = route->table ? route->table : RT_TABLE_MAIN;
+	unsigned char scope = RT_SCOPE_LINK;
+	struct route_nexthop *nh;
+	struct rtnexthop *rtnh;
+	struct nlattr *mp;
+	struct nl_msg *msg;
+	int i;
+
+	for (i = 0; i < route->n_nexthops; i++) {
+		if (route->nexthops[i].dev &&
+		    system_rt_have_gw(&route->nexthops[i].gw, alen))
+			scope = RT_SCOPE_UNIVERSE;
+	}
+
+	struct rtmsg rtm = {
+		.rtm_family = (alen == 4) ? AF_INET : AF_INET6,
+		.rtm_dst_len = route->mask,
+		.rtm_table = (table < 256) ? table : RT_TABLE_UNSPEC,
+		.rtm_protocol = RTPROT_BOOT,
+		.rtm_scope = (cmd == RTM_DELROUTE) ? RT_SCOPE_NOWHERE : scope,
+		.rtm_type = (cmd == RTM_DELROUTE) ? 0 : RTN_UNICAST,
+	};
+
+	msg = nlmsg_alloc_simple(cmd, (cmd == RTM_NEWROUTE) ?
+				 NLM_F_CREATE | NLM_F_REPLACE : 0);
+	if (!msg)
+		return -1;
+
+	nlmsg_append(msg, &rtm, sizeof(rtm), 0);
+
+	if (route->mask)
+		nla_put(msg, RTA_DST, alen, &route->addr);
+
+	if (route->metric > 0)
+		nla_put_u32(msg, RTA_PRIORITY, route->metric);
+
+	if (table >= 256)
+		nla_put_u32(msg, RTA_TABLE, table);
+
+	/* a delete matches the route regardless of its nexthops */
+	if (cmd == RTM_DELROUTE)
+		return system_rtnl_call_batch(msg);
+
+	mp = nla_nest_start(msg, RTA_MULTIPATH);
+	if (!mp)
+		goto error;
+
+	for (i = 0; i < route->n_nexthops; i++) {
+		nh = &route->nexthops[i];
+		if (!nh->dev)
+			continue;
+
+		rtnh = nlmsg_reserve(msg, sizeof(*rtnh), NLMSG_ALIGNTO);
+		if (!rtnh)
+			goto error;
+
+		memset(rtnh, 0, sizeof(*rtnh));
+		rtnh->rtnh_hops = nh->weight - 1;
+		rtnh->rtnh_ifindex = system_if_index(nh->dev);
+
+		if (system_rt_have_gw(&nh->gw, alen) &&
+		    nla_put(msg, RTA_GATEWAY, alen, &nh->gw))
+			goto error;
+
+		rtnh->rtnh_len = (char *) nlmsg_tail(nlmsg_hdr(msg)) - (char *) rtnh;
+	}
+
+	nla_nest_end(msg, mp);
+
+	return system_rtnl_call_batch(msg);
+
+error:
+	nlmsg_free(msg);
+	return -1;
+}
+
+int system_add_mp_route(struct device_mp_route *route)
+{
+	return system_mp_rt(route, RTM_NEWROUTE);
+}
+
+int system_del_mp_route(struct device_mp_route *route)
+{
+	return system_mp_rt(route, RTM_DELROUTE);
+}
+
+bool system_resolve_rt_table(const char *name, unsigned int *id)
+{
+	char *e, *s, buf[128];
+	unsigned int n, table = RT_TABLE_UNSPEC;
+	FILE *f;
+
+	/* first try to parse table as number */
+	if ((n = strtoul(name, &e, 0)) > 0 && !*e)
+		table = n;
+
+	/* handle well known aliases */
+	else if (!strcmp(name, "default"))
+		table = RT_TABLE_DEFAULT;
+	else if (!strcmp(name, "main"))
+		table = RT_TABLE_MAIN;
+	else if (!strcmp(name, "local"))
+		table = RT_TABLE_LOCAL;
+
+	/* try to look up name in /etc/iproute2/rt_tables */
+	else if ((f = fopen("/etc/iproute2/rt_tables", "r")) != NULL) {
+		while (fgets(buf, sizeof(buf) - 1, f) != NULL) {
+			if ((s = strtok(buf, " \t\n")) == NULL || *s == '#')
+				continue;
+
+			n = strtoul(s, NULL, 10);
+
+			if ((s = strtok(NULL, " \t\n")) == NULL)
+				continue;
+
+			if (!strcmp(s, name)) {
+				table = n;
+				break;
+			}
+		}
+
+		fclose(f);
+	}
+
+	if (table == RT_TABLE_UNSPEC)
+		return false;
+
+	*id = table;
+	return true;
+}
+
+static int system_iprule(struct iprule *rule, int cmd)
+{
+	int alen = ((rule->flags & IPRULE_FAMILY) == IPRULE_INET4) ? 4 : 16;
+	unsigned int flags = 0;
+	struct nl_msg *msg;
+	struct rtmsg rtm = {
+		.rtm_family = (alen == 4) ? AF_INET : AF_INET6,
+		.rtm_protocol = RTPROT_STATIC,
+		.rtm_scope = RT_SCOPE_UNIVERSE,
+		.rtm_table = RT_TABLE_UNSPEC,
+		.rtm_type = RTN_UNSPEC,
+	};
+
+	if (cmd == RTM_NEWRULE) {
+		rtm.rtm_type = RTN_UNICAST;
+		flags |= NLM_F_CREATE | NLM_F_EXCL;
+	}
+
+	if (rule->invert)
+		rtm.rtm_flags |= FIB_RULE_INVERT;
+
+	if (rule->flags & IPRULE_SRC)
+		rtm.rtm_src_len = rule->src_mask;
+
+	if (rule->flags & IPRULE_DEST)
+		rtm.rtm_dst_len = rule->dest_mask;
+
+	if (rule->flags & IPRULE_TOS)
+		rtm.rtm_tos = rule->tos;
+
+	if (rule->flags & IPRULE_LOOKUP) {
+		if (rule->lookup < 256)
+			rtm.rtm_table = rule->lookup;
+	}
+
+	if (rule->flags & IPRULE_ACTION)
+		rtm.rtm_type = rule->action;
+	else if (rule->flags & IPRULE_GOTO)
+		rtm.rtm_type = FR_ACT_GOTO;
+
+	msg = nlmsg_alloc_simple(cmd, flags);
+	if (!msg)
+		return -1;
+
+	nlmsg_append(msg, &rtm, sizeof(rtm), 0);
+
+	if (rule->flags & IPRULE_IN)
+		nla_put(msg, FRA_IFNAME, strlen(rule->in_dev) + 1, rule->in_dev);
+
+	if (rule->flags & IPRULE_OUT)
+		nla_put(msg, FRA_OIFNAME, strlen(rule->out_dev) + 1, rule->out_dev);
+
+	if (rule->flags & IPRULE_SRC)
+		nla_put(msg, FRA_SRC, alen, &rule->src_addr);
+
+	if (rule->flags & IPRULE_DEST)
+		nla_put(msg, FRA_DST, alen, &rule->dest_addr);
+
+	if (rule->flags & IPRULE_PRIORITY)
+		nla_put_u32(msg, FRA_PRIORITY, rule->priority);
+
+	if (rule->flags & IPRULE_FWMARK)
+		nla_put_u32(msg, FRA_FWMARK, rule->fwmark);
+
+	if (rule->flags & IPRULE_FWMASK)
+		nla_put_u32(msg, FRA_FWMASK, rule->fwmask);
+
+	if (rule->flags & IPRULE_LOOKUP) {
+		if (rule->lookup >= 256)
+			nla_put_u32(msg, FRA_TABLE, rule->lookup);
+	}
+
+	if (rule->flags & IPRULE_GOTO)
+		nla_put_u32(msg, FRA_GOTO, rule->gotoid);
+
+	return system_rtnl_call_batch(msg);
+}
+
+int system_add_iprule(struct iprule *rule)
+{
+	return system_iprule(rule, RTM_NEWRULE);
+}
+
+int system_del_iprule(struct iprule *rule)
+{
+	return system_iprule(rule, RTM_DELRULE);
+}
+
+bool system_resolve_iprule_action(const char *action, unsigned int *id)
+{
+	char *e;
+	unsigned int n;
+
+	if (!strcmp(action, "unreachable"))
+		n = RTN_UNREACHABLE;
+	else if (!strcmp(action, "prohibit"))
+		n = RTN_PROHIBIT;
+	else if (!strcmp(action, "blackhole"))
+		n = RTN_BLACKHOLE;
+	else if (!strcmp(action, "throw"))
+		n = RTN_THROW;
+	else {
+		n = strtoul(action, &e, 0);
+		if (*e || e == action || n > 255)
+			return false;
+	}
+
+	*id = n;
+	return true;
+}
+
 int system_flush_routes(void)
 {
 	const char *names[] = {
@@ -957,6 +2115,7 @@ int system_flush_routes(void)
 	int fd, i;
 
 	for (i = 0; i < ARRAY_SIZE(names); i++) {
+		netifd_stats.sysfs_opens++;
 		fd = open(names[i], O_WRONLY);
 		if (fd < 0)
 			continue;
@@ -967,18 +2126,36 @@ int system_flush_routes(void)
 	return 0;
 }
 
+static void system_get_monotonic(struct timespec *ts)
+{
+	struct timeval tv;
+
+	if (syscall(__NR_clock_gettime, CLOCK_MONOTONIC, ts) == 0)
+		return;
+
+	if (gettimeofday(&tv, NULL) == 0) {
+		ts->tv_sec = tv.tv_sec;
+		ts->tv_nsec = tv.tv_usec * 1000;
+		return;
+	}
+
+	ts->tv_sec = ts->tv_nsec = 0;
+}
+
 time_t system_get_rtime(void)
 {
 	struct timespec ts;
-	struct timeval tv;
 
-	if (syscall(__NR_clock_gettime, CLOCK_MONOTONIC, &ts) == 0)
-		return ts.tv_sec;
+	system_get_monotonic(&ts);
+	return ts.tv_sec;
+}
 
-	if (gettimeofday(&tv, NULL) == 0)
-		return tv.tv_sec;
+uint64_t system_get_rtime_msec(void)
+{
+	struct timespec ts;
 
-	return 0;
+	system_get_monotonic(&ts);
+	return (uint64_t) ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
 }
 
 #ifndef IP_DF
@@ -1000,13 +2177,16 @@ static int tunnel_ioctl(const char *name, int cmd, void *p)
 	memset(&ifr, 0, sizeof(ifr));
 	strncpy(ifr.ifr_name, name, sizeof(ifr.ifr_name));
 	ifr.ifr_ifru.ifru_data = p;
-	return ioctl(sock_ioctl, cmd, &ifr);
+	return system_ioctl(cmd, &ifr);
 }
 
 int system_del_ip_tunnel(const char *name)
 {
 	struct ip_tunnel_parm p;
 
+	if (!system_link_del(name))
+		return 0;
+
 	tunnel_parm_init(&p);
 	return tunnel_ioctl(name, SIOCDELTUNNEL, &p);
 }
@@ -1019,12 +2199,46 @@ static int parse_ipaddr(struct blob_attr *attr, __be32 *addr)
 	return inet_pton(AF_INET, blobmsg_data(attr), (void *) addr);
 }
 
+static int
+system_add_sit_link(struct device *dev, struct ip_tunnel_parm *p,
+		    struct ip_tunnel_6rd *p6)
+{
+	struct nlattr *linkinfo, *data;
+	struct nl_msg *msg;
+
+	msg = system_link_msg(RTM_NEWLINK, NLM_F_CREATE | NLM_F_EXCL,
+			      dev->ifname, IFF_UP, IFF_UP);
+	if (!msg)
+		return -1;
 
-int system_add_ip_tunnel(const char *name, struct blob_attr *attr)
+	system_link_put_settings(msg, &dev->settings);
+
+	linkinfo = nla_nest_start(msg, IFLA_LINKINFO);
+	nla_put_string(msg, IFLA_INFO_KIND, "sit");
+	data = nla_nest_start(msg, IFLA_INFO_DATA);
+	nla_put_u32(msg, IFLA_IPTUN_LOCAL, p->iph.saddr);
+	nla_put_u32(msg, IFLA_IPTUN_REMOTE, p->iph.daddr);
+	nla_put_u8(msg, IFLA_IPTUN_TTL, p->iph.ttl);
+	nla_put_u8(msg, IFLA_IPTUN_PMTUDISC, 1);
+	if (p6) {
+		nla_put(msg, IFLA_IPTUN_6RD_PREFIX, sizeof(p6->prefix), &p6->prefix);
+		nla_put_u16(msg, IFLA_IPTUN_6RD_PREFIXLEN, p6->prefixlen);
+		nla_put_u32(msg, IFLA_IPTUN_6RD_RELAY_PREFIX, p6->relay_prefix);
+		nla_put_u16(msg, IFLA_IPTUN_6RD_RELAY_PREFIXLEN, p6->relay_prefixlen);
+	}
+	nla_nest_end(msg, data);
+	nla_nest_end(msg, linkinfo);
+
+	return system_link_add(dev, msg);
+}
+
+int system_add_ip_tunnel(struct device *dev, struct blob_attr *attr)
 {
 	struct blob_attr *tb[__TUNNEL_ATTR_MAX];
 	struct blob_attr *cur;
 	struct ip_tunnel_parm p;
+	struct ip_tunnel_6rd p6, *p6rd = NULL;
+	const char *name = dev->ifname;
 	const char *base, *str;
 	bool is_sit;
 
@@ -1061,14 +2275,9 @@ int system_add_ip_tunnel(const char *name, struct blob_attr *attr)
 		p.iph.ttl = val;
 	}
 
-	strncpy(p.name, name, sizeof(p.name));
-	if (tunnel_ioctl(base, SIOCADDTUNNEL, &p) < 0)
-		return -1;
-
 	cur = tb[TUNNEL_ATTR_6RD_PREFIX];
 	if (cur && is_sit) {
 		unsigned int mask;
-		struct ip_tunnel_6rd p6;
 
 		memset(&p6, 0, sizeof(p6));
 
@@ -1084,11 +2293,21 @@ int system_add_ip_tunnel(const char *name, struct blob_attr *attr)
 			p6.relay_prefixlen = mask;
 		}
 
-		if (tunnel_ioctl(name, SIOCADD6RD, &p6) < 0) {
-			system_del_ip_tunnel(name);
-			return -1;
-		}
+		p6rd = &p6;
 	}
 
-	return 0;
+	if (!system_add_sit_link(dev, &p, p6rd))
+		return 0;
+
+	/* kernels without rtnl_link support for sit tunnels */
+	strncpy(p.name, name, sizeof(p.name));
+	if (tunnel_ioctl(base, SIOCADDTUNNEL, &p) < 0)
+		return -1;
+
+	if (p6rd && tunnel_ioctl(name, SIOCADD6RD, p6rd) < 0) {
+		system_del_ip_tunnel(name);
+		return -1;
+	}
+
+	return system_if_up(dev);
 }
@@ -16,8 +16,10 @@
 
 #include <sys/time.h>
 #include <sys/socket.h>
+#include <stdint.h>
 #include "device.h"
 #include "interface-ip.h"
+#include "iprule.h"
 
 enum tunnel_param {
 	TUNNEL_ATTR_TYPE,
@@ -42,6 +44,7 @@ struct bridge_config {
 	enum bridge_opt flags;
 	bool stp;
 	bool igmp_snoop;
+	bool vlan_filtering;
 	int forward_delay;
 
 	int ageing_time;
@@ -49,14 +52,30 @@ struct bridge_config {
 	int max_age;
 };
 
+enum bridge_vlan_flags {
+	BRVLAN_F_PVID		= (1 << 0),
+	BRVLAN_F_UNTAGGED	= (1 << 1),
+};
+
+struct bridge_vlan_range {
+	uint16_t vid;
+	uint16_t vid_end;
+	unsigned int flags;
+};
+
 int system_init(void);
 
+void system_batch_start(void);
+void system_batch_end(void);
+
 int system_bridge_addbr(struct device *bridge, struct bridge_config *cfg);
 int system_bridge_delbr(struct device *bridge);
 int system_bridge_addif(struct device *bridge, struct device *dev);
 int system_bridge_delif(struct device *bridge, struct device *dev);
+int system_bridge_vlan(struct device *dev, struct bridge_vlan_range *r, int n,
+		       bool add, bool self);
 
-int system_vlan_add(struct device *dev, int id);
+int system_vlan_add(struct device *dev, struct device *parent, int id);
 int system_vlan_del(struct device *dev);
 
 void system_if_clear_state(struct device *dev);
@@ -69,15 +88,29 @@ struct device *system_if_get_parent(struct device *dev);
 bool system_if_force_external(const char *ifname);
 
 int system_add_address(struct device *dev, struct device_addr *addr);
+int system_add_address_noprefixroute(struct device *dev, struct device_addr *addr);
+int system_restore_address(struct device *dev, struct device_addr *addr,
+			   bool noprefixroute);
 int system_del_address(struct device *dev, struct device_addr *addr);
 
 int system_add_route(struct device *dev, struct device_route *route);
+int system_restore_route(struct device *dev, struct device_route *route);
 int system_del_route(struct device *dev, struct device_route *route);
 int system_flush_routes(void);
 
+int system_add_mp_route(struct device_mp_route *route);
+int system_del_mp_route(struct device_mp_route *route);
+
+bool system_resolve_rt_table(const char *name, unsigned int *id);
+
+int system_add_iprule(struct iprule *rule);
+int system_del_iprule(struct iprule *rule);
+bool system_resolve_iprule_action(const char *action, unsigned int *id);
+
 int system_del_ip_tunnel(const char *name);
-int system_add_ip_tunnel(const char *name, struct blob_attr *attr);
+int system_add_ip_tunnel(struct device *dev, struct blob_attr *attr);
 
 time_t system_get_rtime(void);
+uint64_t system_get_rtime_msec(void);
 
 #endif
@@ -27,6 +27,9 @@ static struct ubus_context *ctx = NULL;
 static struct blob_buf b;
 static struct netifd_fd ubus_fd;
 static const char *ubus_path;
+static struct ubus_object iface_object;
+
+bool ubus_iface_objects = true;
 
 /* global object */
 
@@ -104,11 +107,133 @@ netifd_get_proto_handlers(struct ubus_context *ctx, struct ubus_object *obj,
 	return 0;
 }
 
+enum {
+	LOG_INTERFACE,
+	LOG_COUNT,
+	__LOG_MAX
+};
+
+static const struct blobmsg_policy log_policy[__LOG_MAX] = {
+	[LOG_INTERFACE] = { .name = "interface", .type = BLOBMSG_TYPE_STRING },
+	[LOG_COUNT] = { .name = "count", .type = BLOBMSG_TYPE_INT32 },
+};
+
+static int
+netifd_get_log(struct ubus_context *ctx, struct ubus_object *obj,
+	       struct ubus_request_data *req, const char *method,
+	       struct blob_attr *msg)
+{
+	struct blob_attr *tb[__LOG_MAX];
+	const char *prefix = NULL;
+	int count = 0;
+
+	blobmsg_parse(log_policy, __LOG_MAX, tb, blob_data(msg), blob_len(msg));
+	if (tb[LOG_INTERFACE])
+		prefix = blobmsg_data(tb[LOG_INTERFACE]);
+
+	if (tb[LOG_COUNT])
+		count = blobmsg_get_u32(tb[LOG_COUNT]);
+
+	blob_buf_init(&b, 0);
+	netifd_log_dump(&b, prefix, count);
+	ubus_send_reply(ctx, req, b.head);
+
+	return 0;
+}
+
+enum {
+	LAT_INTERFACE,
+	__LAT_MAX
+};
+
+static const struct blobmsg_policy latency_policy[__LAT_MAX] = {
+	[LAT_INTERFACE] = { .name = "interface", .type = BLOBMSG_TYPE_STRING },
+};
+
+static int
+netifd_get_latency(struct ubus_context *ctx, struct ubus_object *obj,
+		   struct ubus_request_data *req, const char *method,
+		   struct blob_attr *msg)
+{
+	struct blob_attr *tb[__LAT_MAX];
+	struct interface *iface = NULL;
+
+	blobmsg_parse(latency_policy, __LAT_MAX, tb, blob_data(msg), blob_len(msg));
+	if (tb[LAT_INTERFACE]) {
+		iface = vlist_find(&interfaces, blobmsg_data(tb[LAT_INTERFACE]), iface, node);
+		if (!iface)
+			return UBUS_STATUS_NOT_FOUND;
+	}
+
+	blob_buf_init(&b, 0);
+	interface_timing_dump(&b, iface);
+	ubus_send_reply(ctx, req, b.head);
+
+	return 0;
+}
+
+enum {
+	STATS_RESET,
+	__STATS_MAX
+};
+
+static const struct blobmsg_policy stats_policy[__STATS_MAX] = {
+	[STATS_RESET] = { .name = "reset", .type = BLOBMSG_TYPE_BOOL },
+};
+
+static int
+netifd_handle_stats(struct ubus_context *ctx, struct ubus_object *obj,
+		    struct ubus_request_data *req, const char *method,
+		    struct blob_attr *msg)
+{
+	struct blob_attr *tb[__STATS_MAX];
+	struct netifd_stats *s = &netifd_stats;
+	void *c;
+
+	blobmsg_parse(stats_policy, __STATS_MAX, tb, blob_data(msg), blob_len(msg));
+
+	blob_buf_init(&b, 0);
+	c = blobmsg_open_table(&b, "netlink");
+	blobmsg_add_u32(&b, "requests", s->rtnl_requests);
+	blobmsg_add_u32(&b, "acks", s->rtnl_acks);
+	blobmsg_add_u32(&b, "batch_errors", s->rtnl_batch_errors);
+	blobmsg_close_table(&b, c);
+	blobmsg_add_u32(&b, "ioctls", s->ioctls);
+	blobmsg_add_u32(&b, "sysfs_opens", s->sysfs_opens);
+	blobmsg_add_u32(&b, "forks", s->forks);
+	blobmsg_add_u32(&b, "resolv_conf_writes", s->resolv_conf_writes);
+	c = blobmsg_open_table(&b, "config");
+	blobmsg_add_u32(&b, "reloads", s->config_reloads);
+	blobmsg_add_u32(&b, "last_time", s->config_reload_time);
+	blobmsg_add_u32(&b, "max_time", s->config_reload_time_max);
+	blobmsg_close_table(&b, c);
+	c = blobmsg_open_table(&b, "proto");
+	blobmsg_add_u32(&b, "updates", s->proto_updates);
+	blobmsg_add_u32(&b, "updates_skipped", s->proto_updates_skipped);
+	blobmsg_close_table(&b, c);
+	c = blobmsg_open_table(&b, "repair");
+	blobmsg_add_u32(&b, "addresses", s->addr_repairs);
+	blobmsg_add_u32(&b, "routes", s->route_repairs);
+	blobmsg_close_table(&b, c);
+	c = blobmsg_open_table(&b, "memory");
+	obj_pool_dump(&b);
+	blobmsg_close_table(&b, c);
+	ubus_send_reply(ctx, req, b.head);
+
+	if (blobmsg_get_bool_default(tb[STATS_RESET], false))
+		memset(s, 0, sizeof(*s));
+
+	return 0;
+}
+
 static struct ubus_method main_object_methods[] = {
 	{ .name = "restart", .handler = netifd_handle_restart },
 	{ .name = "reload", .handler = netifd_handle_reload },
 	UBUS_METHOD("add_host_route", netifd_add_host_route, route_policy),
 	{ .name = "get_proto_handlers", .handler = netifd_get_proto_handlers },
+	UBUS_METHOD("get_log", netifd_get_log, log_policy),
+	UBUS_METHOD("get_latency", netifd_get_latency, latency_policy),
+	UBUS_METHOD("stats", netifd_handle_stats, stats_policy),
 };
 
 static struct ubus_object_type main_object_type =
@@ -308,6 +433,10 @@ netifd_ubus_init(const char *path)
 		goto out;
 
 	ret = ubus_add_object(ctx, &dev_object);
+	if (ret)
+		goto out;
+
+	ret = ubus_add_object(ctx, &iface_object);
 
 out:
 	if (ret != 0)
@@ -436,6 +565,41 @@ interface_ip_dump_route_list(struct interface_ip_settings *ip)
 	}
 }
 
+static void
+interface_ip_dump_prefix_list(struct interface_ip_settings *ip)
+{
+	struct device_prefix *prefix;
+	struct device_prefix_assignment *assign;
+	int buflen = 128;
+	char *buf;
+	void *a, *c, *e;
+
+	vlist_for_each_element(&ip->prefix, prefix, node) {
+		a = blobmsg_open_table(&b, NULL);
+
+		buf = blobmsg_alloc_string_buffer(&b, "address", buflen);
+		inet_ntop(AF_INET6, &prefix->addr, buf, buflen);
+		blobmsg_add_string_buffer(&b);
+
+		blobmsg_add_u32(&b, "mask", prefix->length);
+
+		c = blobmsg_open_table(&b, "assigned");
+		list_for_each_entry(assign, &prefix->assignments, head) {
+			e = blobmsg_open_table(&b, assign->name);
+
+			buf = blobmsg_alloc_string_buffer(&b, "address", buflen);
+			inet_ntop(AF_INET6, &assign->subnet, buf, buflen);
+			blobmsg_add_string_buffer(&b);
+
+			blobmsg_add_u32(&b, "mask", assign->length);
+			blobmsg_close_table(&b, e);
+		}
+		blobmsg_close_table(&b, c);
+
+		blobmsg_close_table(&b, a);
+	}
+}
+
 static void
 interface_ip_dump_dns_server_list(struct interface_ip_settings *ip)
 {
@@ -481,6 +645,8 @@ netifd_handle_status(struct ubus_context *ctx, struct ubus_object *obj,
 	if (iface->state == IFS_UP) {
 		time_t cur = system_get_rtime();
 		blobmsg_add_u32(&b, "uptime", cur - iface->start_time);
+		if (iface->update_time)
+			blobmsg_add_u32(&b, "last_update", cur - iface->update_time);
 		blobmsg_add_string(&b, "l3_device", iface->l3_dev.dev->ifname);
 	}
 
@@ -500,6 +666,9 @@ netifd_handle_status(struct ubus_context *ctx, struct ubus_object *obj,
 		interface_ip_dump_address_list(&iface->config_ip, true);
 		interface_ip_dump_address_list(&iface->proto_ip, true);
 		blobmsg_close_array(&b, a);
+		a = blobmsg_open_array(&b, "ipv6-prefix");
+		interface_ip_dump_prefix_list(&iface->proto_ip);
+		blobmsg_close_array(&b, a);
 		a = blobmsg_open_array(&b, "route");
 		interface_ip_dump_route_list(&iface->config_ip);
 		interface_ip_dump_route_list(&iface->proto_ip);
@@ -617,7 +786,7 @@ netifd_handle_iface_prepare(struct ubus_context *ctx, struct ubus_object *obj,
 	if (!dev)
 		return 0;
 
-	ops = dev->hotplug_ops;
+	ops = dev->type->hotplug_ops;
 	if (!ops)
 		return 0;
 
@@ -659,6 +828,104 @@ static struct ubus_method iface_object_methods[] = {
 static struct ubus_object_type iface_object_type =
 	UBUS_OBJECT_TYPE("netifd_iface", iface_object_methods);
 
+/* multiplexing object, reaches every interface through its name */
+
+enum {
+	IFACE_NAME,
+	__IFACE_MAX,
+};
+
+static const struct blobmsg_policy iface_policy[__IFACE_MAX] = {
+	[IFACE_NAME] = { .name = "interface", .type = BLOBMSG_TYPE_STRING },
+};
+
+static struct blob_buf iface_msg;
+
+static int
+netifd_handle_iface(struct ubus_context *ctx, struct ubus_object *obj,
+		    struct ubus_request_data *req, const char *method,
+		    struct blob_attr *msg)
+{
+	struct blob_attr *tb[__IFACE_MAX];
+	struct interface *iface;
+	struct blob_attr *cur;
+	int i, rem;
+
+	blobmsg_parse(iface_policy, __IFACE_MAX, tb, blob_data(msg), blob_len(msg));
+	if (!tb[IFACE_NAME])
+		return UBUS_STATUS_INVALID_ARGUMENT;
+
+	iface = vlist_find(&interfaces, blobmsg_data(tb[IFACE_NAME]), iface, node);
+	if (!iface)
+		return UBUS_STATUS_NOT_FOUND;
+
+	/* strip the interface name before passing the message on */
+	blob_buf_init(&iface_msg, 0);
+	blob_for_each_attr(cur, msg, rem) {
+		if (cur == tb[IFACE_NAME])
+			continue;
+
+		blob_put_raw(&iface_msg, cur, blob_pad_len(cur));
+	}
+
+	for (i = 0; i < ARRAY_SIZE(iface_object_methods); i++) {
+		if (strcmp(method, iface_object_methods[i].name) != 0)
+			continue;
+
+		return iface_object_methods[i].handler(ctx, &iface->ubus, req,
+						       method, iface_msg.head);
+	}
+
+	return UBUS_STATUS_METHOD_NOT_FOUND;
+}
+
+static int
+netifd_handle_iface_dump(struct ubus_context *ctx, struct ubus_object *obj,
+			 struct ubus_request_data *req, const char *method,
+			 struct blob_attr *msg)
+{
+	struct interface *iface;
+	void *a, *i;
+
+	blob_buf_init(&b, 0);
+	a = blobmsg_open_array(&b, "interface");
+	vlist_for_each_element(&interfaces, iface, node) {
+		i = blobmsg_open_table(&b, NULL);
+		blobmsg_add_string(&b, "interface", iface->name);
+		blobmsg_add_u8(&b, "up", iface->state == IFS_UP);
+		blobmsg_add_u8(&b, "pending", iface->state == IFS_SETUP);
+		blobmsg_add_u8(&b, "available", iface->available);
+		blobmsg_add_u8(&b, "autostart", iface->autostart);
+		blobmsg_close_table(&b, i);
+	}
+	blobmsg_close_array(&b, a);
+
+	ubus_send_reply(ctx, req, b.head);
+	return 0;
+}
+
+static struct ubus_method iface_mux_methods[] = {
+	{ .name = "dump", .handler = netifd_handle_iface_dump },
+	UBUS_METHOD("up", netifd_handle_iface, iface_policy),
+	UBUS_METHOD("down", netifd_handle_iface, iface_policy),
+	UBUS_METHOD("status", netifd_handle_iface, iface_policy),
+	UBUS_METHOD("prepare", netifd_handle_iface, iface_policy),
+	UBUS_METHOD("add_device", netifd_handle_iface, iface_policy),
+	UBUS_METHOD("remove_device", netifd_handle_iface, iface_policy),
+	UBUS_METHOD("notify_proto", netifd_handle_iface, iface_policy),
+	UBUS_METHOD("remove", netifd_handle_iface, iface_policy),
+	UBUS_METHOD("set_data", netifd_handle_iface, iface_policy),
+};
+
+static struct ubus_object_type iface_mux_type =
+	UBUS_OBJECT_TYPE("netifd_iface_mux", iface_mux_methods);
+
+static struct ubus_object iface_object = {
+	.name = "network.interface",
+	.type = &iface_mux_type,
+	.methods = iface_mux_methods,
+	.n_methods = ARRAY_SIZE(iface_mux_methods),
+};
 
 void
 netifd_ubus_interface_event(struct interface *iface, bool up)
@@ -675,6 +942,9 @@ netifd_ubus_add_interface(struct interface *iface)
 	struct ubus_object *obj = &iface->ubus;
 	char *name = NULL;
 
+	if (!ubus_iface_objects)
+		return;
+
 	asprintf(&name, "%s.interface.%s", main_object.name, iface->name);
 	if (!name)
 		return;
@@ -14,6 +14,8 @@
 #ifndef __NETIFD_UBUS_H
 #define __NETIFD_UBUS_H
 
+extern bool ubus_iface_objects;
+
 int netifd_ubus_init(const char *path);
 void netifd_ubus_done(void);
 void netifd_ubus_add_interface(struct interface *iface);
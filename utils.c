@@ -18,6 +18,97 @@
 #include <arpa/inet.h>
 #include <netinet/in.h>
 
+#define OBJ_POOL_CHUNK_SIZE	4096
+#define OBJ_POOL_ALIGN		sizeof(void *)
+
+static LIST_HEAD(obj_pools);
+
+static size_t
+obj_pool_size(struct obj_pool *pool)
+{
+	return (pool->size + OBJ_POOL_ALIGN - 1) & ~(OBJ_POOL_ALIGN - 1);
+}
+
+static bool
+obj_pool_grow(struct obj_pool *pool)
+{
+	size_t size = obj_pool_size(pool);
+	unsigned int i, n;
+	char *chunk;
+
+	n = OBJ_POOL_CHUNK_SIZE / size;
+	if (!n)
+		n = 1;
+
+	chunk = malloc(n * size);
+	if (!chunk)
+		return false;
+
+	if (!pool->chunks++)
+		list_add_tail(&pool->list, &obj_pools);
+
+	for (i = 0; i < n; i++) {
+		void **obj = (void **) (chunk + i * size);
+
+		*obj = pool->free_list;
+		pool->free_list = obj;
+	}
+	pool->available += n;
+
+	return true;
+}
+
+void *
+obj_pool_alloc(struct obj_pool *pool)
+{
+	void **obj;
+
+	if (!pool->free_list && !obj_pool_grow(pool))
+		return NULL;
+
+	obj = pool->free_list;
+	pool->free_list = *obj;
+	pool->available--;
+	pool->in_use++;
+	pool->allocs++;
+
+	memset(obj, 0, pool->size);
+	return obj;
+}
+
+void
+obj_pool_free(struct obj_pool *pool, void *ptr)
+{
+	void **obj = ptr;
+
+	if (!ptr)
+		return;
+
+	*obj = pool->free_list;
+	pool->free_list = obj;
+	pool->available++;
+	pool->in_use--;
+}
+
+void
+obj_pool_dump(struct blob_buf *b)
+{
+	struct obj_pool *pool;
+	void *c;
+
+	list_for_each_entry(pool, &obj_pools, list) {
+		c = blobmsg_open_table(b, pool->name);
+		blobmsg_add_u32(b, "object_size", obj_pool_size(pool));
+		blobmsg_add_u32(b, "in_use", pool->in_use);
+		blobmsg_add_u32(b, "available", pool->available);
+		blobmsg_add_u32(b, "bytes", (pool->in_use + pool->available) *
+				obj_pool_size(pool));
+		blobmsg_add_u32(b, "allocs", pool->allocs);
+		blobmsg_add_u32(b, "chunks", pool->chunks);
+		blobmsg_close_table(b, c);
+	}
+}
+
 void
 __vlist_simple_init(struct vlist_simple_tree *tree, int offset)
 {
@@ -70,6 +161,21 @@ vlist_simple_flush_all(struct vlist_simple_tree *tree)
 	vlist_simple_flush(tree);
 }
 
+/* 64 bit FNV-1a, used to detect unchanged data */
+uint64_t
+fnv1a_hash64(const void *data, size_t len)
+{
+	const uint8_t *p = data;
+	uint64_t hash = 0xcbf29ce484222325ULL;
+
+	while (len--) {
+		hash ^= *p++;
+		hash *= 0x100000001b3ULL;
+	}
+
+	return hash;
+}
+
 unsigned int
 parse_netmask_string(const char *str, bool v6)
 {
@@ -110,8 +110,36 @@ static inline int fls(int x)
 }
 #endif
 
+/*
+ * Pool allocator for small fixed-size objects that exist in large numbers.
+ * Objects are carved out of page sized chunks and recycled through a free
+ * list; chunks are never returned to the system.
+ */
+struct obj_pool {
+	struct list_head list;
+	const char *name;
+	size_t size;
+
+	void *free_list;
+	unsigned int chunks;
+	unsigned int in_use;
+	unsigned int available;
+
+	/* objects handed out since startup, chunks are the only mallocs */
+	unsigned int allocs;
+};
+
+#define OBJ_POOL(_name, _type)		\
+	{ .name = _name, .size = sizeof(_type) }
+
+void *obj_pool_alloc(struct obj_pool *pool);
+void obj_pool_free(struct obj_pool *pool, void *ptr);
+void obj_pool_dump(struct blob_buf *b);
+
 unsigned int parse_netmask_string(const char *str, bool v6);
 bool split_netmask(char *str, unsigned int *netmask, bool v6);
 int parse_ip_and_netmask(int af, const char *str, void *addr, unsigned int *netmask);
 
+uint64_t fnv1a_hash64(const void *data, size_t len);
+
 #endif
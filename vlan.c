@@ -24,16 +24,24 @@ struct vlan_device {
 
 	device_state_cb set_state;
 	int id;
+
+	/* index by <parent>.<id>, the ifname may be truncated */
+	struct avl_node avl;
+	char name[IFNAMSIZ + 8];
 };
 
+static struct avl_tree vlan_devices;
+static struct obj_pool vlan_pool = OBJ_POOL("vlan", struct vlan_device);
+
 static void free_vlan_if(struct device *iface)
 {
 	struct vlan_device *vldev;
 
 	vldev = container_of(iface, struct vlan_device, dev);
+	avl_delete(&vlan_devices, &vldev->avl);
 	device_remove_user(&vldev->dep);
 	device_cleanup(&vldev->dev);
-	free(vldev);
+	obj_pool_free(&vlan_pool, vldev);
 }
 
 static int vlan_set_device_state(struct device *dev, bool up)
@@ -53,8 +61,8 @@ static int vlan_set_device_state(struct device *dev, bool up)
 	if (ret)
 		return ret;
 
-	system_vlan_add(vldev->dep.dev, vldev->id);
-	ret = vldev->set_state(dev, true);
+	/* creates the link with its settings applied and brings it up */
+	ret = system_vlan_add(dev, vldev->dep.dev, vldev->id);
 	if (ret)
 		device_release(&vldev->dep);
 
@@ -86,24 +94,25 @@ static struct device *get_vlan_device(struct device *dev, int id, bool create)
 		.free = free_vlan_if,
 	};
 	struct vlan_device *vldev;
-	struct device_user *dep;
+	char name[IFNAMSIZ + 8];
 
 	/* look for an existing interface before creating a new one */
-	list_for_each_entry(dep, &dev->users, list) {
-		if (dep->cb != vlan_dev_cb)
-			continue;
-
-		vldev = container_of(dep, struct vlan_device, dep);
-		if (vldev->id != id)
-			continue;
-
+	snprintf(name, sizeof(name), "%s.%d", dev->ifname, id);
+	vldev = avl_find_element(&vlan_devices, name, vldev, avl);
+	if (vldev)
 		return &vldev->dev;
-	}
 
 	if (!create)
 		return NULL;
 
-	vldev = calloc(1, sizeof(*vldev));
+	vldev = obj_pool_alloc(&vlan_pool);
+	if (!vldev)
+		return NULL;
+
+	strcpy(vldev->name, name);
+	vldev->avl.key = vldev->name;
+	avl_insert(&vlan_devices, &vldev->avl);
+
 	snprintf(vldev->dev.ifname, IFNAMSIZ, "%s.%d", dev->ifname, id);
 
 	device_init(&vldev->dev, &vlan_type, NULL);
@@ -169,3 +178,8 @@ out:
 	free(buf);
 	return dev;
 }
+
+static void __init vlan_init(void)
+{
+	avl_init(&vlan_devices, avl_strcmp, false, NULL);
+}